@@ -2,7 +2,7 @@ from __future__ import division, print_function, unicode_literals, absolute_impo
 
 import numpy as np
 
-def calc_pixmap(first_wcs, second_wcs):
+def calc_pixmap(first_wcs, second_wcs, ymin=0, ymax=0):
     """
     Calculate a mapping between the pixels of two images.
 
@@ -17,6 +17,13 @@ def calc_pixmap(first_wcs, second_wcs):
         A WCS object representing the coordinate system you are
         converting to
 
+    ymin : int, optional
+        The first row of the first image to map.
+
+    ymax : int, optional
+        One past the last row of the first image to map. If it is zero
+        or less, rows are mapped to the end of the image.
+
     Returns
     -------
 
@@ -27,6 +34,9 @@ def calc_pixmap(first_wcs, second_wcs):
     """
 
     first_naxis1, first_naxis2 = first_wcs.pixel_shape
+    if ymax <= 0:
+        ymax = first_naxis2
+    first_naxis2 = ymax - ymin
 
     # We add one to the pixel co-ordinates before the transformation and subtract
     # it afterwards because wcs co-ordinates are one based, while pixel co-ordinates
@@ -37,6 +47,7 @@ def calc_pixmap(first_wcs, second_wcs):
     one = np.ones(2, dtype='float64')
     idxmap = np.indices((first_naxis1, first_naxis2), dtype='float64')
     idxmap = idxmap.transpose() + one
+    idxmap[..., 1] += ymin
 
     idxmap = idxmap.reshape(first_naxis2 * first_naxis1, 2)
 
@@ -0,0 +1,362 @@
+"""
+Save and restore the state of a Drizzle object during a long run.
+
+A checkpoint is a directory holding the raw output images as numpy
+files and the remaining state of the object as json. Each checkpoint is
+a new generation of image files. The metadata file, which names the
+current generation, is replaced atomically once the images are on disk,
+so a crash while saving leaves the previous checkpoint intact.
+
+The files of the generation before the current one are kept, and the
+next generation is made from them by rewriting only the tiles of the
+output changed since they were written, so saving costs in proportion
+to the area drizzled rather than the size of the output.
+"""
+from __future__ import division, print_function, unicode_literals, absolute_import
+
+import json
+import os
+import os.path
+import re
+import shutil
+import threading
+import weakref
+
+import numpy as np
+from numpy.lib.format import open_memmap
+from astropy import wcs
+from astropy.io import fits
+
+from . import cdrizzle
+from . import drizzle
+
+METADATA = "checkpoint.json"
+IMAGES = ("sci", "wht", "con")
+
+
+class Checkpoint(object):
+    """
+    Write checkpoints of a Drizzle object to a directory
+    """
+    def __init__(self, directory):
+        """
+        Create a checkpoint writer. The directory is created if needed.
+
+        Parameters
+        ----------
+
+        directory : str
+            The directory the checkpoint files are written to. An existing
+            checkpoint in the directory is superseded by the next save.
+        """
+
+        self.directory = directory
+        self.generation = 0
+        self.thread = None
+        self.error = None
+
+        # The object whose changes are tracked, its images and the tiles
+        # changed between the last two generations, if known
+        self.driz = None
+        self.images = None
+        self.tracker = None
+        self.previous = None
+
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+
+        metadata = read_metadata(directory)
+        if metadata is not None:
+            self.generation = metadata["generation"]
+
+
+    def save(self, driz):
+        """
+        Save the state of a Drizzle object.
+
+        The first save of an object writes its images in full before
+        returning. Later saves copy only the tiles changed since, and
+        write them to disk in a background thread, so the caller can
+        keep adding images while the checkpoint is written. A save waits
+        for the previous one to finish first.
+
+        Parameters
+        ----------
+
+        driz : Drizzle
+            The object to save.
+        """
+
+        self.wait()
+
+        images = (driz._outsci, driz.outwht, driz.outcon)
+        generation = self.generation + 1
+
+        metadata = {
+            "uniqid": driz.uniqid,
+            "outexptime": driz.outexptime,
+            "wt_scl": driz.wt_scl,
+            "kernel": driz.kernel,
+            "fillval": driz.fillval,
+            "pixfrac": driz.pixfrac,
+            "accumulate": driz.accumulate,
+            "summed": driz._summed,
+            "sciext": driz.sciext,
+            "whtext": driz.whtext,
+            "ctxext": driz.ctxext,
+            "outwcs": driz.outwcs.to_header_string(relax=True),
+            "shape": list(driz.outwcs.pixel_shape),
+            "generation": generation
+            }
+
+        # Nothing is known of the files if the images have been replaced
+        if (self.driz is None or self.driz() is not driz or
+            any(ref() is not image for ref, image in zip(self.images, images))):
+            self.driz = None
+            tracker = driz.track_changes()
+            self.write(images, metadata)
+            self.wait()
+
+            self.driz = weakref.ref(driz)
+            self.images = [weakref.ref(image) for image in images]
+            self.tracker = tracker
+            self.previous = None
+            return
+
+        changes = driz.take_changes(self.tracker)
+
+        # Reuse the files of the generation before the current one if the
+        # tiles changed since they were written are known, else copy the
+        # current generation
+        if self.previous is not None:
+            base = generation - 2
+            tiles = changes | self.previous
+        else:
+            base = generation - 1
+            tiles = changes
+        self.previous = changes
+
+        # Copy the changed tiles now, they change once drizzling resumes
+        size = cdrizzle.DRIZ_TILE_SIZE
+        patches = []
+        for jtile, itile in zip(*np.nonzero(tiles)):
+            rows = slice(jtile * size, (jtile + 1) * size)
+            cols = slice(itile * size, (itile + 1) * size)
+            patches.append((rows, cols, [np.array(image[..., rows, cols])
+                                         for image in images]))
+
+        self.thread = threading.Thread(target=self.write_tiles,
+                                       args=(base, patches, metadata))
+        self.thread.start()
+
+
+    def wait(self):
+        """
+        Wait for the checkpoint being written, if any, to finish and
+        raise any error that occurred while writing it.
+        """
+
+        if self.thread is not None:
+            self.thread.join()
+            self.thread = None
+
+        if self.error is not None:
+            error = self.error
+            self.error = None
+            raise error
+
+
+    def write(self, images, metadata):
+        """
+        Write the images and then the metadata of one checkpoint.
+        """
+
+        try:
+            generation = metadata["generation"]
+            for name, image in zip(IMAGES, images):
+                filename = image_filename(self.directory, name, generation)
+                mapped = open_memmap(filename, mode="w+", dtype=image.dtype,
+                                     shape=image.shape)
+                mapped[...] = image
+                mapped.flush()
+                del mapped
+                sync_file(filename)
+
+            self.write_metadata(metadata)
+
+        except Exception as error:
+            self.error = error
+
+
+    def write_tiles(self, base, patches, metadata):
+        """
+        Make the images of one checkpoint from those of an earlier
+        generation and the tiles changed since, then write its metadata.
+        """
+
+        try:
+            generation = metadata["generation"]
+            for index, name in enumerate(IMAGES):
+                source = image_filename(self.directory, name, base)
+                filename = image_filename(self.directory, name, generation)
+                if base == generation - 1:
+                    shutil.copyfile(source, filename)
+                else:
+                    os.replace(source, filename)
+
+                mapped = np.load(filename, mmap_mode="r+")
+                for rows, cols, tiles in patches:
+                    mapped[..., rows, cols] = tiles[index]
+                mapped.flush()
+                del mapped
+                sync_file(filename)
+
+            self.write_metadata(metadata)
+
+        except Exception as error:
+            # The next save writes every tile
+            self.driz = None
+            self.error = error
+
+
+    def write_metadata(self, metadata):
+        """
+        Replace the metadata, making its generation current, and remove
+        the files of generations no longer needed.
+        """
+
+        generation = metadata["generation"]
+        filename = os.path.join(self.directory, METADATA)
+        with open(filename + ".tmp", "w") as handle:
+            json.dump(metadata, handle)
+            handle.flush()
+            os.fsync(handle.fileno())
+
+        os.replace(filename + ".tmp", filename)
+        sync_directory(self.directory)
+        self.generation = generation
+        remove_stale(self.directory, (generation - 1, generation))
+
+
+def image_filename(directory, name, generation):
+    """
+    Return the name of the file holding one image of one generation
+    """
+
+    return os.path.join(directory, "%s.%d.npy" % (name, generation))
+
+
+def read_metadata(directory):
+    """
+    Read the metadata of the checkpoint in a directory, or None if the
+    directory does not hold a completed checkpoint.
+    """
+
+    filename = os.path.join(directory, METADATA)
+    if not os.path.exists(filename):
+        return None
+
+    with open(filename, "r") as handle:
+        return json.load(handle)
+
+
+def remove_stale(directory, generations):
+    """
+    Remove checkpoint image files not belonging to the given generations.
+    Other files in the directory are left alone.
+    """
+
+    pattern = re.compile(r"^(%s)\.\d+\.npy$" % "|".join(IMAGES))
+    current = set(image_filename(directory, name, generation)
+                  for name in IMAGES for generation in generations)
+
+    for filename in os.listdir(directory):
+        if not pattern.match(filename):
+            continue
+
+        filename = os.path.join(directory, filename)
+        if filename not in current:
+            try:
+                os.remove(filename)
+            except OSError:
+                # Still mapped by a resumed object on some platforms
+                pass
+
+
+def resume(directory):
+    """
+    Restore a Drizzle object from the last completed checkpoint.
+
+    The output images are memory mapped copy on write from the checkpoint
+    files rather than read into memory, so resuming takes little time and
+    only the pages later changed by drizzling are copied. The checkpoint
+    itself is left unchanged until it is saved again.
+
+    Parameters
+    ----------
+
+    directory : str
+        The directory a Checkpoint object saved to.
+
+    Returns
+    -------
+
+    A Drizzle object with the saved state.
+    """
+
+    metadata = read_metadata(directory)
+    if metadata is None:
+        raise ValueError("No checkpoint found in %s" % directory)
+
+    outwcs = wcs.WCS(fits.Header.fromstring(metadata["outwcs"]))
+    outwcs.pixel_shape = tuple(metadata["shape"])
+
+    driz = drizzle.Drizzle(outwcs=outwcs, wt_scl=metadata["wt_scl"],
+                           pixfrac=metadata["pixfrac"],
+                           kernel=metadata["kernel"],
+                           fillval=metadata["fillval"],
+                           accumulate=metadata.get("accumulate", "mean"))
+
+    generation = metadata["generation"]
+    images = [np.load(image_filename(directory, name, generation),
+                      mmap_mode="c") for name in IMAGES]
+
+    driz.outsci, driz.outwht, driz.outcon = images
+    driz._fill_pending = True
+    driz._summed = metadata.get("summed", False)
+    driz.clear_dirty()
+
+    driz.uniqid = metadata["uniqid"]
+    driz.outexptime = metadata["outexptime"]
+    driz.sciext = metadata["sciext"]
+    driz.whtext = metadata["whtext"]
+    driz.ctxext = metadata["ctxext"]
+
+    return driz
+
+
+def sync_directory(directory):
+    """
+    Flush a directory entry to disk where the platform allows it
+    """
+
+    try:
+        handle = os.open(directory, os.O_RDONLY)
+    except OSError:
+        return
+
+    try:
+        os.fsync(handle)
+    except OSError:
+        pass
+    finally:
+        os.close(handle)
+
+
+def sync_file(filename):
+    """
+    Flush the contents of a file to disk
+    """
+
+    with open(filename, "rb+") as handle:
+        os.fsync(handle.fileno())
@@ -0,0 +1,250 @@
+"""
+Blot many small stamps from a large drizzled image.
+
+Blotting a stamp with `Drizzle.blot_image` maps and reads the whole of
+the drizzled image. This module maps only the pixels of each stamp and
+reads only the part of the drizzled image under it, so the image can be
+a memory map of which only the touched pages are loaded. The parts read
+are packed into one atlas image, the stamps into another, and all the
+stamps are blotted in a single call.
+"""
+from __future__ import division, print_function, unicode_literals, absolute_import
+
+import copy
+import math
+
+import numpy as np
+
+from . import calc_pixmap
+from . import cdrizzle
+from . import util
+
+# Distance in pixels from a point at which each interpolation reads
+INTERP_REACH = {"nearest": 1, "linear": 1, "poly3": 2, "poly5": 3,
+                "sinc": 15, "lsinc": 15, "lan3": 4, "lan5": 4}
+
+
+def blot_cutouts(source, source_wcs, stamps, exptime=1.0, interp='poly5',
+                 sinscl=1.0, misval=0.0, affine=False):
+    """
+    Resample a list of small stamps from a large image.
+
+    Parameters
+    ----------
+
+    source : 2d array
+        The image the stamps are cut from, in units of 'cps'. It may be
+        a memory map, only the parts under the stamps are read.
+
+    source_wcs : wcs
+        The source image WCS.
+
+    stamps : list of wcs
+        The WCS of each stamp, with its pixel_shape set. `stamp_wcs`
+        creates one from a position and size.
+
+    exptime : float, optional
+        The exposure time the blotted stamps are scaled to.
+
+    interp : str, optional
+        The type of interpolation, as for `doblot.doblot`.
+
+    sinscl : float, optional
+        The scaling factor for sinc interpolation.
+
+    misval : float, optional
+        The value of stamp pixels which fall off the source image.
+
+    affine : bool, optional
+        Map each stamp with the affine transform through three of its
+        corners rather than through the WCS at every pixel. This is much
+        faster, and exact enough when the distortion across a stamp is
+        small.
+
+    Returns
+    -------
+
+    A list with the blotted image of each stamp.
+    """
+
+    if interp not in INTERP_REACH:
+        raise ValueError("Unknown interpolation: %s" % interp)
+
+    reach = INTERP_REACH[interp]
+    ny, nx = source.shape
+    util.set_pscale(source_wcs)
+
+    results = []
+    groups = {}
+    for stamp in stamps:
+        stamp = strip_distortion(stamp)
+        util.set_pscale(stamp)
+
+        shape = tuple(stamp.pixel_shape[::-1])
+        result = np.full(shape, misval, dtype=np.float32)
+        results.append(result)
+
+        if affine:
+            pixmap = affine_pixmap(stamp, source_wcs)
+        else:
+            pixmap = calc_pixmap.calc_pixmap(stamp, source_wcs)
+
+        # The part of the source read by the stamp's interpolation
+        xpix = pixmap[..., 0]
+        ypix = pixmap[..., 1]
+        x0 = max(int(math.floor(xpix.min())) - reach, 0)
+        x1 = min(int(math.ceil(xpix.max())) + reach + 1, nx)
+        y0 = max(int(math.floor(ypix.min())) - reach, 0)
+        y1 = min(int(math.ceil(ypix.max())) + reach + 1, ny)
+        if x0 >= x1 or y0 >= y1:
+            continue
+
+        part = {"pixmap": pixmap, "box": (y0, y1, x0, x1), "result": result}
+
+        # Parts cut by the edge of the source must be reflected at it, so
+        # they are blotted on their own rather than beside another part
+        if x0 == 0 or y0 == 0 or x1 == nx or y1 == ny:
+            blot_parts(source, [part], source_wcs.pscale / stamp.pscale,
+                       exptime, interp, sinscl, misval)
+        else:
+            scale = source_wcs.pscale / stamp.pscale
+            groups.setdefault(scale, []).append(part)
+
+    # Stamps with the same pixel scale are blotted together
+    for scale, parts in groups.items():
+        blot_parts(source, parts, scale, exptime, interp, sinscl, misval)
+
+    return results
+
+
+def blot_parts(source, parts, scale, exptime, interp, sinscl, misval):
+    """
+    Pack the source boxes and stamps of several parts into atlases and
+    blot them in one call.
+    """
+
+    boxes = [(y1 - y0, x1 - x0) for y0, y1, x0, x1 in
+             [part["box"] for part in parts]]
+    box_offsets, box_shape = pack(boxes)
+    stamp_offsets, stamp_shape = pack([part["result"].shape for part in parts])
+
+    atlas = np.zeros(box_shape, dtype=np.float32)
+    atlas_map = np.full(stamp_shape + (2,), -1.0, dtype=np.float64)
+
+    for part, (by, bx), (sy, sx) in zip(parts, box_offsets, stamp_offsets):
+        y0, y1, x0, x1 = part["box"]
+        atlas[by:by + y1 - y0, bx:bx + x1 - x0] = source[y0:y1, x0:x1]
+
+        # Points off the source stay off the atlas
+        pixmap = part["pixmap"]
+        xpix = pixmap[..., 0]
+        ypix = pixmap[..., 1]
+        inside = ((xpix >= 0.0) & (xpix < source.shape[1]) &
+                  (ypix >= 0.0) & (ypix < source.shape[0]))
+
+        ny, nx = part["result"].shape
+        view = atlas_map[sy:sy + ny, sx:sx + nx]
+        view[..., 0] = np.where(inside, xpix - x0 + bx, -1.0)
+        view[..., 1] = np.where(inside, ypix - y0 + by, -1.0)
+
+    output = np.zeros(stamp_shape, dtype=np.float32)
+    cdrizzle.tblot(atlas, atlas_map, output, scale=scale, kscale=1.0,
+                   interp=interp, exptime=exptime, misval=misval,
+                   sinscl=sinscl)
+
+    for part, (sy, sx) in zip(parts, stamp_offsets):
+        ny, nx = part["result"].shape
+        part["result"][...] = output[sy:sy + ny, sx:sx + nx]
+
+
+def pack(shapes):
+    """
+    Place rectangles in rows of a roughly square atlas.
+
+    Returns the (y, x) offset of each rectangle and the atlas shape.
+    """
+
+    area = sum(ny * nx for ny, nx in shapes)
+    width = max([int(math.ceil(math.sqrt(area)))] + [nx for ny, nx in shapes])
+
+    offsets = []
+    x = y = height = 0
+    for ny, nx in shapes:
+        if x + nx > width:
+            x = 0
+            y += height
+            height = 0
+        offsets.append((y, x))
+        x += nx
+        height = max(height, ny)
+
+    return offsets, (y + height, width)
+
+
+def affine_pixmap(first_wcs, second_wcs):
+    """
+    Calculate the mapping between the pixels of two images as the affine
+    transform through three corners of the first image.
+    """
+
+    nx, ny = first_wcs.pixel_shape
+    corners = np.array([[1.0, 1.0], [nx, 1.0], [1.0, ny]])
+
+    world = first_wcs.all_pix2world(corners, 1)
+    if second_wcs.sip is None:
+        pixels = second_wcs.wcs_world2pix(world, 1) - 1.0
+    else:
+        pixels = second_wcs.all_world2pix(world, 1) - 1.0
+
+    origin = pixels[0]
+    xstep = (pixels[1] - origin) / max(nx - 1, 1)
+    ystep = (pixels[2] - origin) / max(ny - 1, 1)
+
+    y, x = np.indices((ny, nx), dtype=np.float64)
+    return (origin + x[..., np.newaxis] * xstep + y[..., np.newaxis] * ystep)
+
+
+def stamp_wcs(source_wcs, center, shape):
+    """
+    Create the WCS of a stamp aligned with the pixels of the source image.
+
+    Parameters
+    ----------
+
+    source_wcs : wcs
+        The source image WCS.
+
+    center : tuple
+        The right ascension and declination of the stamp center, in
+        degrees.
+
+    shape : tuple
+        The number of rows and columns of the stamp.
+
+    Returns
+    -------
+
+    The WCS of the stamp.
+    """
+
+    ny, nx = shape
+    xcen, ycen = source_wcs.all_world2pix([center], 0)[0]
+    x0 = int(round(xcen - (nx - 1) / 2.0))
+    y0 = int(round(ycen - (ny - 1) / 2.0))
+
+    the_wcs = source_wcs.slice((slice(y0, y0 + ny), slice(x0, x0 + nx)))
+    the_wcs.pixel_shape = (nx, ny)
+    return the_wcs
+
+
+def strip_distortion(the_wcs):
+    """
+    Copy a WCS without its distortion, as `doblot.doblot` blots onto it
+    """
+
+    the_wcs = copy.deepcopy(the_wcs)
+    the_wcs.sip = None
+    the_wcs.cpdis1 = None
+    the_wcs.cpdis2 = None
+    the_wcs.det2im = None
+    return the_wcs
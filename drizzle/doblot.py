@@ -14,7 +14,8 @@ STScI Python compatable blot module
 """
 
 def doblot(source, source_wcs, blot_wcs, exptime, coeffs = True,
-            interp='poly5', sinscl=1.0, stepsize=10, wcsmap=None):
+            interp='poly5', sinscl=1.0, stepsize=10, wcsmap=None,
+            blotted=None, dirty=None):
     """
     Low level routine for performing the 'blot' operation.
 
@@ -26,8 +27,10 @@ def doblot(source, source_wcs, blot_wcs, exptime, coeffs = True,
     Parameters
     ----------
 
-    source : 2d array
-        Input numpy array of the source image in units of 'cps'.
+    source : 2d or 3d array
+        Input numpy array of the source image in units of 'cps'. A 3d
+        array is a stack of images, each blotted through the same
+        mapping, which is computed once for all of them.
 
     source_wcs : wcs
         The source image WCS.
@@ -50,10 +53,21 @@ def doblot(source, source_wcs, blot_wcs, exptime, coeffs = True,
     sincscl : float, optional
         The scaling factor for sinc interpolation.
 
+    blotted : 2d or 3d array, optional
+        The result of an earlier blot of the source image onto the same
+        WCS. If present, it is updated in place and returned.
+
+    dirty : 2d array, optional
+        A uint8 map of the tiles of the source image, each
+        `cdrizzle.DRIZ_TILE_SIZE` pixels on a side, which have changed
+        since blotted was computed. Only the pixels of blotted which
+        depend on these tiles are recomputed.
+
     Returns
     -------
 
-    A 2d numpy array with the blotted image
+    A numpy array with the blotted image, or stack of blotted images
+    if the source is a stack
 
     Other Parameters
     ----------------
@@ -69,7 +83,17 @@ def doblot(source, source_wcs, blot_wcs, exptime, coeffs = True,
         Was used when input to output mapping was computed
         internally. Is no longer used and only here for backwards compatibility.
     """
-    _outsci = np.zeros(blot_wcs.pixel_shape[::-1], dtype=np.float32)
+    shape = tuple(blot_wcs.pixel_shape[::-1])
+    if np.ndim(source) == 3:
+        shape = (np.shape(source)[0],) + shape
+
+    if blotted is None:
+        _outsci = np.zeros(shape, dtype=np.float32)
+        dirty = None
+    elif blotted.dtype != np.float32 or not blotted.flags.c_contiguous:
+        raise ValueError("Blotted image must be a contiguous float32 array")
+    else:
+        _outsci = blotted
 
     # compute the undistorted 'natural' plate scale
     wcslin = blot_wcs
@@ -82,6 +106,7 @@ def doblot(source, source_wcs, blot_wcs, exptime, coeffs = True,
     pix_ratio = source_wcs.pscale/blot_wcs.pscale
 
     cdrizzle.tblot(source, pixmap, _outsci, scale=pix_ratio, kscale=1.0,
-                   interp=interp, exptime=exptime, misval=0.0, sinscl=sinscl)
+                   interp=interp, exptime=exptime, misval=0.0, sinscl=sinscl,
+                   dirty=dirty)
 
     return _outsci
@@ -0,0 +1,324 @@
+from __future__ import division, print_function, unicode_literals, absolute_import
+
+# STDLIB
+import concurrent.futures
+import os
+
+# THIRD-PARTY
+import numpy as np
+from astropy.io import fits
+
+# LOCAL
+from . import util
+from . import calc_pixmap
+from . import cdrizzle
+from . import drizzle
+from . import merge
+
+"""
+Cosmic ray rejection by drizzling and blotting
+"""
+
+def docrreject(insci, inwcs, outwcs, inwht=None, expin=None, in_units="cps",
+               gain=1.0, readnoise=0.0, sky=None, snr=(3.5, 3.0),
+               scale=(2.0, 1.5), grow=0, interp='poly5', pixfrac=1.0,
+               kernel='square', combine='median', nsigma=4.0, median=None,
+               workdir=None, nrows=None, nthreads=None):
+    """
+    Find the cosmic rays in a set of overlapping images.
+
+    Each image is drizzled onto the output WCS on its own, and the median
+    of the drizzled images is a model of the sky free of cosmic rays. The
+    model is blotted back onto each image and the pixels which differ from
+    it by more than the noise are flagged. The median, blotting and
+    comparison stream through the images in bands of rows, so their
+    memory use depends on the width of the images only.
+
+    Parameters
+    ----------
+
+    insci : list of 2d arrays
+        The input images.
+
+    inwcs : list of wcs
+        The world coordinate system of each input image.
+
+    outwcs : wcs
+        The world coordinate system the images are combined on.
+
+    inwht : list of 2d arrays, optional
+        The weight of each input image. Output pixels with no weight in
+        any image have no model, and input pixels mapping to them are
+        not flagged.
+
+    expin : list of float, optional
+        The exposure time of each image. The default is one.
+
+    in_units : str, optional
+        The units of the input images, "cps" or "counts".
+
+    gain : float, optional
+        Electrons per count of the input images.
+
+    readnoise : float, optional
+        The read noise, in electrons.
+
+    sky : list of float, optional
+        The sky level subtracted from each image, in count rate units,
+        which adds to its noise.
+
+    snr : tuple of two floats, optional
+        The signal to noise ratio above which a pixel is a cosmic ray, and
+        the lower ratio used for pixels next to a cosmic ray.
+
+    scale : tuple of two floats, optional
+        The fractions of the model's derivative added to the thresholds of
+        the two tests, allowing for errors in the model at sharp features.
+
+    grow : int, optional
+        The radius in pixels each cosmic ray is grown by.
+
+    interp : str, optional
+        The interpolation used in blotting the model, as for
+        `doblot.doblot`.
+
+    pixfrac, kernel : optional
+        The drizzle parameters, as for `Drizzle`.
+
+    combine : str, optional
+        How the drizzled images are combined, "median" or "minmed". See
+        `median_image`.
+
+    nsigma : float, optional
+        For "minmed", the number of standard deviations of the minimum
+        the median must exceed it by for the minimum to be used.
+
+    median : 2d array, optional
+        The model of the sky in count rate units on the output WCS. If
+        given, the images are not drizzled.
+
+    workdir : str, optional
+        A directory the drizzled images are written to, rather than kept
+        in memory. They are read back a band at a time to find the median.
+
+    nrows : int, optional
+        The number of rows of an image masked at a time. The default is
+        the tile size used to track changes to the output.
+
+    nthreads : int, optional
+        The number of images processed in parallel. The default is the
+        number of processors.
+
+    Returns
+    -------
+
+    A list with a uint8 mask for each image, one where there is a cosmic
+    ray and zero elsewhere.
+    """
+
+    nimage = len(insci)
+    if len(inwcs) != nimage:
+        raise ValueError("Number of images and WCS do not match")
+
+    if inwht is None:
+        inwht = [None] * nimage
+    if expin is None:
+        expin = [1.0] * nimage
+    if sky is None:
+        sky = [0.0] * nimage
+    if nrows is None:
+        nrows = cdrizzle.DRIZ_TILE_SIZE
+    if nthreads is None:
+        nthreads = os.cpu_count() or 1
+
+    if workdir is None:
+        outfiles = [None] * nimage
+    else:
+        outfiles = [os.path.join(workdir, "single%d.fits" % i)
+                    for i in range(nimage)]
+
+    with concurrent.futures.ThreadPoolExecutor(nthreads) as executor:
+        if median is None:
+            singles = list(executor.map(
+                lambda args: drizzle_single(*args, outwcs=outwcs,
+                                            in_units=in_units,
+                                            pixfrac=pixfrac, kernel=kernel),
+                zip(insci, inwcs, inwht, expin, outfiles)))
+
+            keywords = dict(combine=combine, nsigma=nsigma, gain=gain,
+                            readnoise=readnoise, nrows=nrows,
+                            nthreads=nthreads)
+            if workdir is None:
+                median = median_image(singles, **keywords)
+            else:
+                median = median_products(singles, **keywords)
+            del singles
+
+        median = np.ascontiguousarray(median, dtype=np.float32)
+
+        def mask_one(args):
+            sci, the_wcs, exptime, level = args
+            if in_units == "counts":
+                sci = np.asarray(sci, dtype=np.float32) / exptime
+            return mask_image(sci, the_wcs, median, outwcs, exptime=exptime,
+                              gain=gain, readnoise=readnoise, sky=level,
+                              snr=snr, scale=scale, grow=grow, interp=interp,
+                              nrows=nrows)
+
+        return list(executor.map(mask_one, zip(insci, inwcs, expin, sky)))
+
+
+def drizzle_single(insci, inwcs, inwht, expin, outfile=None, outwcs=None,
+                   in_units="cps", pixfrac=1.0, kernel='square'):
+    """
+    Drizzle one image on its own, returning its image and weight, or
+    the name of the file they are written to.
+    """
+
+    driz = drizzle.Drizzle(outwcs=outwcs, pixfrac=pixfrac, kernel=kernel)
+    driz.add_image(insci, inwcs, inwht=inwht, expin=expin, in_units=in_units)
+
+    if outfile is None:
+        return driz.outsci, driz.outwht
+
+    driz.write(outfile)
+    return outfile
+
+
+def median_image(singles, combine='median', nsigma=4.0, gain=1.0,
+                 readnoise=0.0, scale=None, nrows=None, nthreads=None):
+    """
+    Combine separately drizzled images as their median.
+
+    The images are read and combined a band of rows at a time, so they
+    may be memory maps, and the bands are combined in parallel. Pixels
+    with no weight are ignored, and pixels with no weight in any image
+    are NaN in the result.
+
+    Parameters
+    ----------
+
+    singles : list of tuples
+        The image and weight of each drizzled image.
+
+    combine : str, optional
+        "median" for the median of each pixel, or "minmed" for the
+        minimum where the median is more than nsigma standard deviations
+        of the minimum above it. With few images the median is pulled up
+        by cosmic rays in any of them, while the minimum is not.
+
+    nsigma, gain, readnoise : float, optional
+        The noise model of "minmed". The gain is in electrons per unit of
+        the images and the read noise in electrons.
+
+    scale : list of float, optional
+        Factor multiplying each image.
+
+    nrows : int, optional
+        The number of rows combined at a time. The default is the tile
+        size used to track changes to the output.
+
+    nthreads : int, optional
+        The number of bands combined in parallel. The default is the
+        number of processors.
+
+    Returns
+    -------
+
+    The combined image.
+    """
+
+    if nrows is None:
+        nrows = cdrizzle.DRIZ_TILE_SIZE
+    if nthreads is None:
+        nthreads = os.cpu_count() or 1
+    if scale is None:
+        scale = [1.0] * len(singles)
+
+    ny, nx = singles[0][0].shape
+    median = np.empty((ny, nx), dtype=np.float32)
+
+    def combine_band(start):
+        stop = min(start + nrows, ny)
+        data = np.empty((len(singles), stop - start, nx), dtype=np.float32)
+        weights = np.empty_like(data)
+        for k, (sci, wht) in enumerate(singles):
+            data[k] = sci[start:stop]
+            weights[k] = wht[start:stop]
+            if scale[k] != 1.0:
+                data[k] *= scale[k]
+
+        cdrizzle.tmedian(data, weights, median[start:stop], combine=combine,
+                         nsigma=nsigma, gain=gain, readnoise=readnoise,
+                         fill=np.nan)
+
+    with concurrent.futures.ThreadPoolExecutor(nthreads) as executor:
+        list(executor.map(combine_band, range(0, ny, nrows)))
+
+    return median
+
+
+def median_products(infiles, **keywords):
+    """
+    Combine drizzled images written by `Drizzle.write` as their median.
+
+    The files are memory mapped, so only a band of rows of each is in
+    memory at a time. The keywords are those of `median_image`.
+    """
+
+    handles = [fits.open(infile, memmap=True) for infile in infiles]
+    try:
+        products = [merge.read_product(handle) for handle in handles]
+        singles = [(product["sci"], product["wht"]) for product in products]
+        scale = [1.0 / product["expscale"] for product in products]
+        return median_image(singles, scale=scale, **keywords)
+
+    finally:
+        for handle in handles:
+            handle.close()
+
+
+def mask_image(insci, inwcs, median, outwcs, exptime=1.0, gain=1.0,
+               readnoise=0.0, sky=0.0, snr=(3.5, 3.0), scale=(2.0, 1.5),
+               grow=0, interp='poly5', nrows=None):
+    """
+    Flag the cosmic rays in one image by comparing it with the median.
+
+    The median is blotted onto the image and compared with it a band of
+    rows at a time, each read with enough rows around it that the result
+    does not depend on the band size. The image and median are in count
+    rate units. Returns the uint8 mask.
+    """
+
+    if nrows is None:
+        nrows = cdrizzle.DRIZ_TILE_SIZE
+
+    util.set_pscale(inwcs)
+    util.set_pscale(outwcs)
+    pix_ratio = outwcs.pscale / inwcs.pscale
+
+    ny, nx = insci.shape
+    halo = grow + 2
+    mask = np.zeros((ny, nx), dtype=np.uint8)
+
+    for start in range(0, ny, nrows):
+        stop = min(start + nrows, ny)
+        first = max(start - halo, 0)
+        last = min(stop + halo, ny)
+
+        # Blot the model over the band and its halo, NaN off the median
+        pixmap = calc_pixmap.calc_pixmap(inwcs, outwcs, ymin=first, ymax=last)
+        model = np.empty((last - first, nx), dtype=np.float32)
+        cdrizzle.tblot(median, pixmap, model, scale=pix_ratio, kscale=1.0,
+                       interp=interp, exptime=1.0, misval=np.nan)
+
+        band = np.ascontiguousarray(insci[first:last], dtype=np.float32)
+        band_mask = np.zeros(band.shape, dtype=np.uint8)
+        cdrizzle.tcrmask(band, model, band_mask, ystart=start - first,
+                         ystop=stop - first, gain=gain, readnoise=readnoise,
+                         exptime=exptime, sky=sky, snr1=snr[0], snr2=snr[1],
+                         scale1=scale[0], scale2=scale[1], grow=grow)
+
+        mask[start:stop] = band_mask[start - first:stop - first]
+
+    return mask
@@ -17,7 +17,9 @@ def dodrizzle(insci, input_wcs, inwht,
               expin, in_units, wt_scl,
               wcslin_pscale=1.0, uniqid=1,
               xmin=0, xmax=0, ymin=0, ymax=0,
-              pixfrac=1.0, kernel='square', fillval="INDEF"):
+              pixfrac=1.0, kernel='square', fillval="INDEF", dirty=None,
+              pixmap=None, accumulate="mean", dq=None, bits=0,
+              ivm=False, sky=0.0, flat=None, dark=0.0, readnoise=0.0):
     """
     Low level routine for performing 'drizzle' operation.on one image.
 
@@ -35,10 +37,12 @@ def dodrizzle(insci, input_wcs, inwht,
     input_wcs : 2d array
         The world coordinate system of the input image.
 
-    inwht : 2d array
+    inwht : 2d array or float
         A 2d numpy array containing the pixel by pixel weighting.
-        Must have the same dimensions as insci. If none is supplied,
-        the weghting is set to one.
+        Must have the same dimensions as insci. A single number weights
+        every pixel equally. If none is supplied, the weighting is set
+        to one. Float32 arrays in native byte order are read without
+        being copied.
 
     output_wcs : wcs
         The world coordinate system of the output image.
@@ -123,6 +127,48 @@ def dodrizzle(insci, input_wcs, inwht,
         The value a pixel is set to in the output if the input image does
         not overlap it. The default value of INDEF does not set a value.
 
+    dirty: 2d array, optional
+        A uint8 map of the tiles of the output image, each
+        `cdrizzle.DRIZ_TILE_SIZE` pixels on a side. The tiles changed
+        by this image are set to one.
+
+    pixmap: 3d array, optional
+        The mapping of input to output pixel coordinates, as computed by
+        `calc_pixmap.calc_pixmap`. If not set, it is computed from the
+        input and output WCS.
+
+    accumulate: str, optional
+        What the output image holds. The default, "mean", keeps the
+        weighted mean of the inputs, updated by every input pixel. With
+        "sum" the output holds the weighted sum of the inputs, which is
+        cheaper to update, and must be divided by the output weight once
+        all images are added.
+
+    dq: 2d array, optional
+        The data quality flags of the input image, an 8, 16 or 32 bit
+        integer array with the same dimensions. Signed flags are read as
+        the same bits unsigned. Pixels with any flag set that is
+        not in bits are given zero weight, without building a weight
+        image for them.
+
+    bits: int, optional
+        The data quality flags which do not mark a pixel as bad.
+
+    ivm: bool, optional
+        Multiply the weight of each pixel by its inverse variance,
+        ``flat**2 / (sky * flat + dark + readnoise**2)``, computed as it is
+        drizzled. The noise model is in electrons. The square of the
+        exposure time is left to wt_scl.
+
+    sky: float or 2d array, optional
+        The sky level of the input image, a number or an image.
+
+    flat: 2d array, optional
+        The flat field the input image was divided by. The default is one.
+
+    dark, readnoise: float, optional
+        The dark current and read noise of the input image.
+
     Returns
     -------
     A tuple with three values: a version string, the number of pixels
@@ -144,14 +190,6 @@ def dodrizzle(insci, input_wcs, inwht,
     else:
         expscale = expin
 
-    # Add input weight image if it was not passed in
-
-    if (insci.dtype > np.float32):
-        insci = insci.astype(np.float32)
-
-    if inwht is None:
-        inwht = np.ones_like(insci)
-
     # Compute what plane of the context image this input would
     # correspond to:
     planeid = int((uniqid-1) / 32)
@@ -174,7 +212,8 @@ def dodrizzle(insci, input_wcs, inwht,
     pix_ratio = output_wcs.pscale / wcslin_pscale
 
     # Compute the mapping between the input and output pixel coordinates
-    pixmap = calc_pixmap.calc_pixmap(input_wcs, output_wcs)
+    if pixmap is None:
+        pixmap = calc_pixmap.calc_pixmap(input_wcs, output_wcs)
 
     #
     # Call 'drizzle' to perform image combination
@@ -185,6 +224,8 @@ def dodrizzle(insci, input_wcs, inwht,
         uniqid=uniqid, xmin=xmin, xmax=xmax,
         ymin=ymin, ymax=ymax, scale=pix_ratio, pixfrac=pixfrac,
         kernel=kernel, in_units=in_units, expscale=expscale,
-        wtscale=wt_scl, fillstr=fillval)
+        wtscale=wt_scl, fillstr=fillval, dirty=dirty,
+        accumulate=accumulate, dq=dq, bits=bits, ivm=ivm, sky=sky,
+        flat=flat, dark=dark, readnoise=readnoise)
 
     return _vers, nmiss, nskip
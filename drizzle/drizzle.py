@@ -10,8 +10,12 @@ images into a single output image using the drizzle algorithm.
 from __future__ import division, print_function, unicode_literals, absolute_import
 
 # SYSTEM
+import collections
+import concurrent.futures
 import os
 import os.path
+import threading
+import weakref
 
 # THIRD-PARTY
 
@@ -21,8 +25,16 @@ from astropy.io import fits
 
 # LOCAL
 from . import util
+from . import calc_pixmap
 from . import doblot
 from . import dodrizzle
+from . import writer
+from . import cdrizzle
+from . import cutout
+
+# Rows beyond a band passed to the kernels, so that pixels at the edge
+# of a band map as they would in the whole image
+BAND_HALO = 2
 
 class Drizzle(object):
     """
@@ -30,7 +42,7 @@ class Drizzle(object):
     """
     def __init__(self, infile="", outwcs=None,
                  wt_scl="exptime", pixfrac=1.0, kernel="square",
-                 fillval="INDEF"):
+                 fillval="INDEF", accumulate="mean"):
         """
         Create a new Drizzle output object and set the drizzle parameters.
 
@@ -57,8 +69,10 @@ class Drizzle(object):
         wt_scl : str, optional
             How each input image should be scaled. The choices are `exptime`
             which scales each image by its exposure time, `expsq` which scales
-            each image by the exposure time squared, or an empty string, which
-            allows each input image to be scaled individually.
+            each image by the exposure time squared, `ivm` which weights each
+            pixel by its inverse variance, computed from the noise model
+            given to `add_image`, or an empty string, which allows each input
+            image to be scaled individually.
 
         pixfrac : float, optional
             The fraction of a pixel that the pixel flux is confined to. The
@@ -76,13 +90,29 @@ class Drizzle(object):
         fillval : str, otional
             The value a pixel is set to in the output if the input image does
             not overlap it. The default value of INDEF does not set a value.
+            The fill is applied once, when the output image is next read,
+            rather than after every input image.
+
+        accumulate : str, optional
+            How the output image is accumulated. The default, "mean", keeps
+            the weighted mean up to date after every input pixel. With "sum"
+            the weighted sum is accumulated instead, which avoids a division
+            for every input pixel. Reading the output image then returns a
+            copy divided by the weight, made once after images are added,
+            and the sum itself is only divided when `finalize` is called.
         """
 
+        if accumulate not in ("mean", "sum"):
+            raise ValueError("Accumulate must be mean or sum")
+
         # Initialize the object fields
 
         self.outsci = None
         self.outwht = None
         self.outcon = None
+        self._outdirty = None
+        self._touched = None
+        self._trackers = []
 
         self.outexptime = 0.0
         self.uniqid = 0
@@ -92,6 +122,7 @@ class Drizzle(object):
         self.kernel = kernel
         self.fillval = fillval
         self.pixfrac = float(pixfrac)
+        self.accumulate = accumulate
 
         self.sciext = "SCI"
         self.whtext = "WHT"
@@ -126,15 +157,24 @@ class Drizzle(object):
                 except KeyError:
                     pass
 
+                wht_format = util.get_keyword(handle, "DRIZWHTF",
+                                              default="float32")
+                ctx_format = util.get_keyword(handle, "DRIZCTXF",
+                                              default="int32")
+
                 try:
                     hdu = handle[self.whtext]
-                    self.outwht = hdu.data.copy().astype(np.float32)
+                    self.outwht = writer.decode_weights(hdu.data, wht_format)
                 except KeyError:
                     pass
 
                 try:
                     hdu = handle[self.ctxext]
-                    self.outcon = hdu.data.copy().astype(np.int32)
+                    if ctx_format == "dictionary":
+                        table = handle[self.ctxext + "TAB"].data
+                        self.outcon = writer.decode_context(hdu.data, table)
+                    else:
+                        self.outcon = hdu.data.copy().astype(np.int32)
                     if self.outcon.ndim == 2:
                         self.outcon = np.reshape(self.outcon, (1,
                                                  self.outcon.shape[0],
@@ -162,7 +202,7 @@ class Drizzle(object):
 
         if util.is_blank(self.wt_scl):
             self.wt_scl = ''
-        elif self.wt_scl != "exptime" and self.wt_scl != "expsq":
+        elif self.wt_scl not in ("exptime", "expsq", "ivm"):
             raise ValueError("Illegal value for wt_scl: %s" % out_units)
 
         if out_units == "counts":
@@ -185,10 +225,15 @@ class Drizzle(object):
                                     outwcs_naxis1),
                                     dtype=np.int32)
 
+        # Output read from a file starts clean, new output starts dirty
+        self.outdirty = self.new_dirty()
+        if not util.is_blank(infile) and os.path.exists(infile):
+            self.clear_dirty()
+
 
     def add_fits_file(self, infile, inweight="",
                       xmin=0, xmax=0, ymin=0, ymax=0,
-                      unitkey="", expkey="", wt_scl=1.0):
+                      unitkey="", expkey="", wt_scl=1.0, nthreads=None):
         """
         Combine a fits file with the output drizzled image.
 
@@ -247,6 +292,214 @@ class Drizzle(object):
             initialized with wt_scl set to "exptime" or "expsq", the exposure time
             will be used to set the weight scaling and the value of this parameter
             will be ignored.
+
+        nthreads : int, optional
+            If the input image is tile compressed, the number of threads
+            decompressing it. The default is the number of processors.
+        """
+
+        if is_compressed(infile):
+            self.add_compressed_file(infile, inweight=inweight,
+                                     xmin=xmin, xmax=xmax, ymin=ymin, ymax=ymax,
+                                     unitkey=unitkey, expkey=expkey,
+                                     wt_scl=wt_scl, nthreads=nthreads)
+            return
+
+        insci, inwcs, inwht, in_units, expin = \
+            self.read_fits_file(infile, inweight, unitkey, expkey)
+
+        self.add_image(insci, inwcs, inwht=inwht,
+                       xmin=xmin, xmax=xmax, ymin=ymin, ymax=ymax,
+                       expin=expin, in_units=in_units, wt_scl=wt_scl)
+
+
+    def add_fits_files(self, infiles, inweights=None, prefetch=2,
+                       xmin=0, xmax=0, ymin=0, ymax=0,
+                       unitkey="", expkey="", wt_scl=1.0):
+        """
+        Combine a list of fits files with the output drizzled image.
+
+        The result is the same as calling `add_fits_file` on each file in
+        turn, but the next files are read and their pixel maps computed
+        by background threads while the current file is drizzled. Tile
+        compressed files are decoded in bands by `add_compressed_file`.
+
+        Parameters
+        ----------
+
+        infiles : list of str
+            The names of the fits files, possibly including an extension.
+
+        inweights : list of str, optional
+            The names of the files containing the weighting of each input
+            file. If it is not set, all weights are set to one.
+
+        prefetch : int, optional
+            The number of files read ahead of the one being drizzled. At
+            most this many files besides the current one are held in memory.
+
+        xmin, xmax, ymin, ymax, unitkey, expkey, wt_scl : optional
+            The same as for `add_fits_file`, used for every file.
+        """
+
+        if inweights is None:
+            inweights = [""] * len(infiles)
+        elif len(inweights) != len(infiles):
+            raise ValueError("Number of weight files != number of input files")
+
+        # Each thread computes pixel maps through its own output WCS copy
+        local = threading.local()
+
+        def prepare(infile, inweight):
+            # Compressed files are decoded in bands when they are combined
+            if is_compressed(infile):
+                return None
+
+            if not hasattr(local, "outwcs"):
+                local.outwcs = self.outwcs.deepcopy()
+
+            insci, inwcs, inwht, in_units, expin = \
+                self.read_fits_file(infile, inweight, unitkey, expkey)
+            pixmap = calc_pixmap.calc_pixmap(inwcs, local.outwcs)
+            return insci, inwcs, inwht, in_units, expin, pixmap
+
+        def combine(infile, inweight, future):
+            prepared = future.result()
+            if prepared is None:
+                self.add_compressed_file(infile, inweight=inweight,
+                                         xmin=xmin, xmax=xmax,
+                                         ymin=ymin, ymax=ymax,
+                                         unitkey=unitkey, expkey=expkey,
+                                         wt_scl=wt_scl)
+                return
+
+            insci, inwcs, inwht, in_units, expin, pixmap = prepared
+            self.add_image(insci, inwcs, inwht=inwht,
+                           xmin=xmin, xmax=xmax, ymin=ymin, ymax=ymax,
+                           expin=expin, in_units=in_units, wt_scl=wt_scl,
+                           pixmap=pixmap)
+
+        # Drizzling releases the GIL, so reading continues meanwhile
+        pending = collections.deque()
+        with concurrent.futures.ThreadPoolExecutor(max(1, prefetch)) as executor:
+            for infile, inweight in zip(infiles, inweights):
+                pending.append((infile, inweight,
+                                executor.submit(prepare, infile, inweight)))
+                if len(pending) > prefetch:
+                    combine(*pending.popleft())
+
+            while pending:
+                combine(*pending.popleft())
+
+
+    def add_compressed_file(self, infile, inweight="",
+                            xmin=0, xmax=0, ymin=0, ymax=0,
+                            unitkey="", expkey="", wt_scl=1.0, nthreads=None):
+        """
+        Combine a tile compressed fits file with the output drizzled image.
+
+        The image is decompressed a band of rows at a time by a pool of
+        threads, and each band is drizzled as soon as it has been decoded.
+        Only a few bands are held in memory and decompression overlaps
+        with drizzling. The parameters are those of `add_fits_file`.
+        """
+
+        if nthreads is None:
+            nthreads = os.cpu_count() or 1
+
+        fileroot, extn = util.parse_filename(infile)
+        if not os.path.exists(fileroot):
+            raise ValueError("Drizzle cannot find input file: %s" % infile)
+
+        with fits.open(fileroot) as handle:
+            hdu = util.get_extn(handle, extn=extn)
+            inwcs = wcs.WCS(header=hdu.header)
+            naxis2 = hdu.shape[0]
+
+        in_units = util.get_keyword(fileroot, unitkey, "cps")
+        expin = util.get_keyword(fileroot, expkey, 1.0)
+
+        if ymax <= 0:
+            ymax = naxis2
+        nrows = cdrizzle.DRIZ_TILE_SIZE
+
+        # Each thread reads through its own file handles and WCS copies
+        local = threading.local()
+        handles = []
+        lock = threading.Lock()
+
+        def read_rows(filename, first, last):
+            sections = local.__dict__.setdefault("sections", {})
+            if filename not in sections:
+                fileroot, extn = util.parse_filename(filename)
+                handle = fits.open(fileroot)
+                with lock:
+                    handles.append(handle)
+                sections[filename] = util.get_extn(handle, extn=extn).section
+            return np.array(sections[filename][first:last], dtype=np.float32)
+
+        def decode(start, stop):
+            if not hasattr(local, "inwcs"):
+                local.inwcs = inwcs.deepcopy()
+                local.outwcs = self.outwcs.deepcopy()
+
+            first = max(0, start - BAND_HALO)
+            last = min(naxis2, stop + BAND_HALO)
+            insci = read_rows(infile, first, last)
+            inwht = None
+            if not util.is_blank(inweight):
+                inwht = read_rows(inweight, first, last)
+
+            pixmap = calc_pixmap.calc_pixmap(local.inwcs, local.outwcs,
+                                             ymin=first, ymax=last)
+            return first, insci, inwht, pixmap
+
+        util.set_pscale(inwcs)
+        if self.wt_scl == "exptime":
+            wt_scl = expin
+        elif self.wt_scl == "expsq" or self.wt_scl == "ivm":
+            wt_scl = expin * expin
+
+        self.increment_id()
+        self.outexptime += expin
+        self.begin_sum()
+
+        def combine(start, stop, future):
+            first, insci, inwht, pixmap = future.result()
+            dodrizzle.dodrizzle(insci, inwcs, inwht, self.outwcs,
+                                self._outsci, self.outwht, self.outcon,
+                                expin, in_units, wt_scl,
+                                wcslin_pscale=inwcs.pscale, uniqid=self.uniqid,
+                                xmin=xmin, xmax=xmax,
+                                ymin=start - first, ymax=stop - first,
+                                pixfrac=self.pixfrac, kernel=self.kernel,
+                                fillval="INDEF", dirty=self._touched,
+                                pixmap=pixmap, accumulate=self.accumulate,
+                                ivm=(self.wt_scl == "ivm"))
+
+        pending = collections.deque()
+        try:
+            with concurrent.futures.ThreadPoolExecutor(nthreads) as executor:
+                for start in range(ymin, ymax, nrows):
+                    stop = min(start + nrows, ymax)
+                    pending.append((start, stop,
+                                    executor.submit(decode, start, stop)))
+                    if len(pending) > nthreads:
+                        combine(*pending.popleft())
+
+                while pending:
+                    combine(*pending.popleft())
+        finally:
+            for handle in handles:
+                handle.close()
+
+        self._fill_pending = True
+
+
+    def read_fits_file(self, infile, inweight="", unitkey="", expkey=""):
+        """
+        Read an input image, its WCS, weights, units and exposure time
+        as used by `add_fits_file`.
         """
 
         insci = None
@@ -282,14 +535,14 @@ class Drizzle(object):
         in_units = util.get_keyword(fileroot, unitkey, "cps")
         expin = util.get_keyword(fileroot, expkey, 1.0)
 
-        self.add_image(insci, inwcs, inwht=inwht,
-                       xmin=xmin, xmax=xmax, ymin=ymin, ymax=ymax,
-                       expin=expin, in_units=in_units, wt_scl=wt_scl)
+        return insci, inwcs, inwht, in_units, expin
 
 
     def add_image(self, insci, inwcs, inwht=None,
                   xmin=0, xmax=0, ymin=0, ymax=0,
-                  expin=1.0, in_units="cps", wt_scl=1.0):
+                  expin=1.0, in_units="cps", wt_scl=1.0, pixmap=None,
+                  dq=None, bits=0, sky=0.0, flat=None, dark=0.0,
+                  readnoise=0.0):
         """
         Combine an input image with the output drizzled image.
 
@@ -308,10 +561,12 @@ class Drizzle(object):
             The world coordinate system of the input image. This is
             used to convert the pixels to the output coordinate system.
 
-        inwht : array, optional
+        inwht : array or float, optional
             A 2d numpy array containing the pixel by pixel weighting.
-            Must have the same dimenstions as insci. If none is supplied,
-            the weghting is set to one.
+            Must have the same dimenstions as insci. A single number
+            weights every pixel equally. If none is supplied, the
+            weghting is set to one. No weights are read for a number or
+            none.
 
         xmin : float, optional
             This and the following three parameters set a bounding rectangle
@@ -354,31 +609,141 @@ class Drizzle(object):
             initialized with wt_scl set to "exptime" or "expsq", the exposure time
             will be used to set the weight scaling and the value of this parameter
             will be ignored.
+
+        pixmap : array, optional
+            The mapping of input to output pixel coordinates, as computed by
+            `calc_pixmap.calc_pixmap`. If not set, it is computed from the
+            input and output WCS.
+
+        dq : array, optional
+            A 2d 8, 16 or 32 bit integer array with the data quality flags
+            of the input image, read as unsigned. Pixels with any flag set that is not in bits are
+            given zero weight.
+
+        bits : int, optional
+            The data quality flags which do not mark a pixel as bad. The
+            default of zero rejects every flagged pixel.
+
+        sky, flat, dark, readnoise : optional
+            The noise model of the input image when drizzle was initialized
+            with wt_scl set to "ivm". The sky, a number or an image, the dark
+            current and the read noise are in electrons, and flat is an
+            image of the flat field the input was divided by. The weight of
+            each pixel is multiplied by its inverse variance,
+            ``(expin * flat)**2 / (sky * flat + dark + readnoise**2)``,
+            computed as it is drizzled.
         """
 
-        insci = insci.astype(np.float32)
-        util.set_pscale(inwcs)
+        # Float32 images are passed to the C core without a copy, and
+        # missing weights are not filled in
+        insci = np.asarray(insci, dtype=np.float32)
+        if inwht is not None and not np.isscalar(inwht):
+            inwht = np.asarray(inwht, dtype=np.float32)
 
-        if inwht is None:
-            inwht = np.ones(insci.shape, dtype=insci.dtype)
-        else:
-            inwht = inwht.astype(np.float32)
+        util.set_pscale(inwcs)
 
         if self.wt_scl == "exptime":
             wt_scl = expin
-        elif self.wt_scl == "expsq":
+        elif self.wt_scl == "expsq" or self.wt_scl == "ivm":
             wt_scl = expin * expin
 
         self.increment_id()
         self.outexptime += expin
 
+        # Filling is deferred until the output is read, as pixels with
+        # zero weight are overwritten by the next input that covers them
+
+        self.begin_sum()
+
         dodrizzle.dodrizzle(insci, inwcs, inwht, self.outwcs,
-                            self.outsci, self.outwht, self.outcon,
+                            self._outsci, self.outwht, self.outcon,
                             expin, in_units, wt_scl,
                             wcslin_pscale=inwcs.pscale, uniqid=self.uniqid,
                             xmin=xmin, xmax=xmax, ymin=ymin, ymax=ymax,
                             pixfrac=self.pixfrac, kernel=self.kernel,
-                            fillval=self.fillval)
+                            fillval="INDEF", dirty=self._touched,
+                            pixmap=pixmap, accumulate=self.accumulate,
+                            dq=dq, bits=bits, ivm=(self.wt_scl == "ivm"),
+                            sky=sky, flat=flat, dark=dark, readnoise=readnoise)
+
+        self._fill_pending = True
+
+    @property
+    def outsci(self):
+        """
+        The combined output image. If images have been added since
+        it was last read, output pixels with zero weight are first set
+        to the fill value. While a weighted sum is accumulated this is
+        a copy divided by the weight, and the sum is left unchanged.
+        `write` divides the sum as it is written instead, without a copy.
+        """
+        if self._summed:
+            if self._normalized is None:
+                self._normalized = self.normalize()
+            return self._normalized
+
+        if self._fill_pending:
+            self._fill_pending = False
+            fill_value = util.parse_fillval(self.fillval)
+            if fill_value is not None:
+                np.copyto(self._outsci, fill_value, where=(self.outwht == 0.0))
+
+        return self._outsci
+
+    @outsci.setter
+    def outsci(self, value):
+        self._outsci = value
+        self._fill_pending = False
+        self._summed = False
+        self._normalized = None
+
+    def begin_sum(self):
+        """
+        Convert the output image from a weighted mean to a weighted sum
+        before images are added to it, when accumulating sums.
+        """
+        self._normalized = None
+        if self.accumulate != "sum" or self._summed:
+            return
+
+        empty = self.outwht == 0.0
+        np.multiply(self._outsci, self.outwht, out=self._outsci)
+        np.copyto(self._outsci, 0.0, where=empty)
+        self._summed = True
+        self._touched[...] = 1
+
+    def normalize(self):
+        """
+        Return the weighted sum of the output image divided by the
+        weight, with pixels of zero weight set to the fill value.
+        """
+        return writer.divide_image(self._outsci, self.fill_divisor())
+
+    def fill_divisor(self):
+        """
+        Return the weights dividing a weighted sum and the value of pixels
+        with zero weight, for writing the sum without normalizing it first
+        """
+        fill_value = util.parse_fillval(self.fillval)
+        if fill_value is None:
+            fill_value = 0.0
+        return self.outwht, fill_value
+
+    def finalize(self):
+        """
+        Divide the weighted sum of the output image by the weight, so it
+        holds the weighted mean, when no more images will be added. This
+        does nothing unless images have been summed since. Pixels with
+        zero weight are zero until they are filled.
+        """
+        if not self._summed:
+            return
+
+        np.divide(self._outsci, self.outwht, out=self._outsci,
+                  where=(self.outwht != 0.0))
+        self._summed = False
+        self._normalized = None
+        self._touched[...] = 1
 
 
     def blot_fits_file(self, infile, interp='poly5', sinscl=1.0):
@@ -425,6 +790,12 @@ class Drizzle(object):
         """
         Resample the output image using an input world coordinate system.
 
+        The output image is replaced by the resampled image and the output
+        WCS by blotwcs, so every tile is marked as changed. To blot the
+        output repeatedly while images are still being added, recomputing
+        only what depends on the changed tiles, call `doblot.doblot` with
+        the previous result as blotted and this object's `outdirty`.
+
         Parameters
         ----------
 
@@ -448,6 +819,132 @@ class Drizzle(object):
                                     1.0, interp=interp, sinscl=sinscl)
 
         self.outwcs = blotwcs
+        self.outdirty = self.new_dirty()
+
+
+    def blot_cutouts(self, stamps, interp='poly5', sinscl=1.0, affine=False):
+        """
+        Resample small stamps from the output image, leaving it unchanged.
+
+        Parameters
+        ----------
+
+        stamps : list of wcs
+            The world coordinate system of each stamp, with its
+            pixel_shape set. `cutout.stamp_wcs` creates one from a position
+            and size.
+
+        interp : str, optional
+            The type of interpolation used in the resampling, as for
+            `blot_image`.
+
+        sincscl : float, optional
+            The scaling factor for sinc interpolation.
+
+        affine : bool, optional
+            Map each stamp with an affine transform rather than the full
+            WCS, which is faster for stamps with little distortion.
+
+        Returns
+        -------
+
+        A list with the resampled image of each stamp.
+        """
+
+        return cutout.blot_cutouts(self.outsci, self.outwcs, stamps,
+                                   interp=interp, sinscl=sinscl, affine=affine)
+
+
+    def new_dirty(self):
+        """
+        Create a map of tiles of the output image with every tile marked
+        as changed.
+
+        Each tile is `cdrizzle.DRIZ_TILE_SIZE` pixels on a side. Drizzling
+        sets the tiles that it changes to one.
+        """
+
+        tile = cdrizzle.DRIZ_TILE_SIZE
+        ntile = [(n + tile - 1) // tile for n in self._outsci.shape]
+        return np.ones(ntile, dtype=np.uint8)
+
+
+    @property
+    def outdirty(self):
+        """
+        The map of tiles of the output image changed since the map was
+        last cleared by `clear_dirty`.
+        """
+        self.sweep_dirty()
+        return self._outdirty
+
+    @outdirty.setter
+    def outdirty(self, value):
+        # Replacing the map marks its tiles as changed for every tracker
+        self._outdirty = value
+        self._touched = np.array(value, dtype=np.uint8)
+
+
+    def sweep_dirty(self):
+        """
+        Add the tiles changed by drizzling since the last sweep to the
+        changed tiles map and to the map of each tracker.
+        """
+
+        if not self._touched.any():
+            return
+
+        self._outdirty |= self._touched
+        trackers = []
+        for ref in self._trackers:
+            tracker = ref()
+            if tracker is None:
+                continue
+            if tracker.shape == self._touched.shape:
+                tracker |= self._touched
+            trackers.append(ref)
+        self._trackers = trackers
+        self._touched[...] = 0
+
+
+    def track_changes(self):
+        """
+        Return a new map of the tiles of the output image changed from now
+        on, for a reader such as a checkpoint that cannot share `outdirty`
+        with the caller. The map is updated as long as it is referenced;
+        read and reset it with `take_changes`.
+        """
+
+        self.sweep_dirty()
+        tracker = np.zeros_like(self._touched)
+        self._trackers.append(weakref.ref(tracker))
+        return tracker
+
+
+    def take_changes(self, tracker):
+        """
+        Return the tiles changed since a map made by `track_changes` was
+        last read, and mark them as unchanged in the map.
+        """
+
+        self.sweep_dirty()
+        changes = tracker.copy()
+        tracker[...] = 0
+        return changes
+
+
+    def clear_dirty(self):
+        """
+        Mark every tile of the output image as unchanged
+
+        Call this after the output has been written or blotted, so that
+        later calls to `write` with update set, or to `doblot.doblot`
+        with a previous result and this object's `outdirty`, only process
+        what has changed since. Maps made by `track_changes` are kept.
+        """
+
+        self.sweep_dirty()
+        self._outdirty[...] = 0
 
 
     def increment_id(self):
@@ -475,7 +972,9 @@ class Drizzle(object):
         self.uniqid += 1
 
 
-    def write(self, outfile, out_units="cps", outheader=None):
+    def write(self, outfile, out_units="cps", outheader=None, update=False,
+              nthreads=None, compress=None, wht_format="float32",
+              ctx_format="int32"):
         """
         Write the output from a set of drizzled images to a file.
 
@@ -502,11 +1001,56 @@ class Drizzle(object):
         outheader : header, optional
             A fits header containing cards to be added to the primary
             header of the output image.
+
+        update : bool, optional
+            If the output file already exists with the same layout, only
+            rewrite the tiles of each extension which have changed since
+            the dirty tiles were last cleared. Otherwise the whole file is
+            written. Output in counts is always written in full, as
+            every pixel is rescaled by the total exposure time.
+
+        nthreads : int, optional
+            The number of threads converting and writing the images. The
+            default is the number of processors.
+
+        compress : str, optional
+            Tile compress the extensions with this compression type, such
+            as "RICE_1" or "GZIP_2". Floating point images are written
+            losslessly by the gzip types and quantized by the others.
+            Compressed output is always written in full.
+
+        wht_format : str, optional
+            The storage of the weight image, either `float32`, `float16`
+            (half precision stored as 16 bit integers) or `uint16` (scaled
+            so the largest weight is 65535.) Half precision holds weights
+            up to 65504 with three significant digits, so it is not suited
+            to weights scaled by exposure time or inverse variance, and
+            larger weights raise a ValueError. The extension of a float16
+            weight image carries the DRIZWHTF keyword, as other readers
+            see only its integers.
+
+        ctx_format : str, optional
+            The storage of the context image, either `int32` or
+            `dictionary`. A dictionary context image holds the index of
+            each pixel's bit pattern in a table of the distinct patterns,
+            written to an extension named by appending "TAB" to the
+            context extension name. If there are more than 65536 patterns
+            the context image is written in full.
         """
 
         if out_units != "counts" and out_units != "cps":
             raise ValueError("Illegal value for out_units: %s" % str(out_units))
 
+        if wht_format not in ("float32", "float16", "uint16"):
+            raise ValueError("Illegal value for wht_format: %s" % str(wht_format))
+
+        if ctx_format not in ("int32", "dictionary"):
+            raise ValueError("Illegal value for ctx_format: %s" % str(ctx_format))
+
+        compact = wht_format != "float32" or ctx_format != "int32"
+        if update and not compress and not compact and self.update_file(outfile, out_units, outheader):
+            return
+
         # Write the WCS to the output image
 
         handle = self.outwcs.to_fits()
@@ -542,10 +1086,12 @@ class Drizzle(object):
         phdu.header['EXPTIME'] = \
             (self.outexptime, 'Drizzle, total exposure time')
 
+        # Counts are scaled as the image is written, leaving it unchanged
         outexptime = 1.0
+        scale = None
         if out_units == 'counts':
-            np.multiply(self.outsci, self.outexptime, self.outsci)
             outexptime = self.outexptime
+            scale = outexptime
         phdu.header['DRIZEXPT'] = \
         (outexptime, 'Drizzle, exposure time scaling factor')
 
@@ -559,26 +1105,132 @@ class Drizzle(object):
 
         extheader = self.outwcs.to_header()
 
-        ehdu = fits.ImageHDU()
-        ehdu.data = self.outsci
-        ehdu.header['EXTNAME'] = (self.sciext, 'Extension name')
-        ehdu.header['EXTVER'] = (1, 'Extension version')
-        ehdu.header.extend(extheader, unique=True)
-        handle.append(ehdu)
-
-        whdu = fits.ImageHDU()
-        whdu.data = self.outwht
-        whdu.header['EXTNAME'] = (self.whtext, 'Extension name')
-        whdu.header['EXTVER'] = (1, 'Extension version')
-        whdu.header.extend(extheader, unique=True)
-        handle.append(whdu)
-
-        xhdu = fits.ImageHDU()
-        xhdu.data = self.outcon
-        xhdu.header['EXTNAME'] = (self.ctxext, 'Extension name')
-        xhdu.header['EXTVER'] = (1, 'Extension version')
-        xhdu.header.extend(extheader, unique=True)
-        handle.append(xhdu)
-
-        handle.writeto(outfile, overwrite=True)
+        # Encode the weight and context images in their storage formats
+
+        outwht = self.outwht
+        whtcards = None
+        if wht_format == "float16":
+            top = float(np.max(outwht)) if outwht.size else 0.0
+            if top > np.finfo(np.float16).max:
+                raise ValueError("Weights up to %g overflow wht_format float16, "
+                                 "use uint16 or float32" % top)
+            outwht = outwht.astype(np.float16).view(np.int16)
+            whtcards = fits.Header()
+            whtcards['DRIZWHTF'] = \
+                ('float16', 'Drizzle, half precision stored as int16')
+        elif wht_format == "uint16":
+            outwht, whtcards = writer.quantize_weights(outwht)
+
+        outcon = self.outcon
+        concards = None
+        table = None
+        if ctx_format == "dictionary":
+            encoded = writer.dictionary_context(outcon)
+            if encoded is None:
+                ctx_format = "int32"
+            else:
+                outcon, concards, table = encoded
+
+        phdu.header['DRIZWHTF'] = \
+            (wht_format, 'Drizzle, storage of output weighting image')
+        phdu.header['DRIZCTXF'] = \
+            (ctx_format, 'Drizzle, storage of output context image')
+
+        # A weighted sum is divided by the weights as it is written
+        if self._summed:
+            outsci, divisor = self._outsci, self.fill_divisor()
+        else:
+            outsci, divisor = self.outsci, None
+
+        images = [(self.sciext, outsci, scale, None, divisor),
+                  (self.whtext, outwht, None, whtcards, None),
+                  (self.ctxext, outcon, None, concards, None)]
+        if table is not None:
+            images.append((self.ctxext + "TAB", table, None, None, None))
+
+        extensions = []
+        for extname, image, image_scale, cards, image_divisor in images:
+            header = fits.Header()
+            if cards is not None:
+                header.extend(cards, strip=False)
+            header['EXTNAME'] = (extname, 'Extension name')
+            header['EXTVER'] = (1, 'Extension version')
+            header.extend(extheader, unique=True)
+            extensions.append((header, image, image_scale, image_divisor))
+
+        # The images are converted to big endian a chunk at a time
+        writer.write_product(outfile, phdu.header, extensions,
+                             nthreads=nthreads, compress=compress)
         handle.close()
+
+
+    def update_file(self, outfile, out_units, outheader):
+        """
+        Rewrite the changed tiles of an existing output file in place.
+
+        Returns False, leaving the file unchanged, if the file does not
+        exist or its extensions do not match the output images.
+        """
+
+        if out_units != "cps" or not os.path.exists(outfile):
+            return False
+
+        # A weighted sum is divided by the weights a tile at a time
+        if self._summed:
+            outsci = self._outsci
+            weights, fill_value = self.fill_divisor()
+        else:
+            outsci = self.outsci
+        images = (outsci, self.outwht, self.outcon)
+
+        with fits.open(outfile, mode="update", memmap=True) as handle:
+            if util.get_keyword(handle, "DRIZOUUN", default="cps") != "cps":
+                return False
+
+            try:
+                hdus = [handle[extname] for extname in
+                        (self.sciext, self.whtext, self.ctxext)]
+            except KeyError:
+                return False
+
+            for hdu, image in zip(hdus, images):
+                if (hdu.data is None or hdu.data.shape != image.shape or
+                    hdu.data.dtype.kind != image.dtype.kind or
+                    hdu.data.dtype.itemsize != image.dtype.itemsize or
+                    'BSCALE' in hdu.header or 'BZERO' in hdu.header):
+                    return False
+
+            tile = cdrizzle.DRIZ_TILE_SIZE
+            for jtile, itile in zip(*np.nonzero(self.outdirty)):
+                rows = slice(jtile * tile, (jtile + 1) * tile)
+                cols = slice(itile * tile, (itile + 1) * tile)
+                for hdu, image in zip(hdus, images):
+                    values = image[..., rows, cols]
+                    if self._summed and image is outsci:
+                        values = writer.divide_image(
+                            values, (weights[rows, cols], fill_value))
+                    hdu.data[..., rows, cols] = values
+
+            phdu = handle[0]
+            phdu.header['NDRIZIM'] = (self.uniqid, 'Drizzle, number of images')
+            phdu.header['EXPTIME'] = \
+                (self.outexptime, 'Drizzle, total exposure time')
+
+            if outheader:
+                phdu.header.extend(outheader, unique=True, update=True)
+
+        return True
+
+
+def is_compressed(infile):
+    """
+    Return True if the image in a fits file is tile compressed
+    """
+
+    fileroot, extn = util.parse_filename(infile)
+    if util.is_blank(infile) or not os.path.exists(fileroot):
+        return False
+
+    with fits.open(fileroot) as handle:
+        hdu = util.get_extn(handle, extn=extn)
+        return isinstance(hdu, fits.CompImageHDU)
@@ -0,0 +1,230 @@
+"""
+Merge drizzle products computed separately into a single product.
+
+When the input images of a mosaic are split across several processes,
+each process writes a partial product with its own SCI, WHT and CTX
+extensions. This module combines the partial products as the weighted
+mean of their SCI extensions and renumbers their context bits so each
+input image keeps its own bit. The products are read and the result is
+written one band of rows at a time, so memory use does not depend on
+the size of the mosaic.
+"""
+from __future__ import division, print_function, unicode_literals, absolute_import
+
+import argparse
+import concurrent.futures
+import os
+
+import numpy as np
+from astropy import wcs
+from astropy.io import fits
+
+from . import cdrizzle
+from . import util
+from . import writer
+
+
+def merge_products(infiles, outfile, fillval=None, nrows=None, nthreads=None):
+    """
+    Merge partial drizzle products into a single output file.
+
+    Parameters
+    ----------
+
+    infiles : list of str
+        The partial products, written by `Drizzle.write`. They must all
+        have the same output WCS. The context bits of each product follow
+        those of the products before it in the list.
+
+    outfile : str
+        The name of the merged product. It is overwritten if it exists.
+        The output is always in counts per second.
+
+    fillval : str, optional
+        The value of output pixels with no weight in any product. If not
+        set, the fill value of the first product is used.
+
+    nrows : int, optional
+        The number of rows merged at a time. The default is the tile size
+        used to track changes to the output.
+
+    nthreads : int, optional
+        The number of bands of rows merged in parallel. The default is the
+        number of processors.
+    """
+
+    if len(infiles) == 0:
+        raise ValueError("No products to merge")
+
+    if nrows is None:
+        nrows = cdrizzle.DRIZ_TILE_SIZE
+
+    if nthreads is None:
+        nthreads = os.cpu_count() or 1
+
+    handles = [fits.open(infile, memmap=True) for infile in infiles]
+    try:
+        products = [read_product(handle) for handle in handles]
+        first = products[0]
+
+        for product in products[1:]:
+            if product["sci"].shape != first["sci"].shape:
+                raise ValueError("Products have different image dimensions")
+            if not product["wcs"].wcs.compare(first["wcs"].wcs):
+                raise ValueError("Products have different output WCS")
+
+        if fillval is None:
+            fillval = util.get_keyword(handles[0], "DRIZFVAL", default="INDEF")
+        fill_value = util.parse_fillval(fillval)
+        if fill_value is None:
+            fill_value = 0.0
+
+        # Each product's context bits are shifted past those before it
+        offsets = np.cumsum([0] + [product["nimage"] for product in products])
+        nplane = max(1, (int(offsets[-1]) + 31) // 32)
+        ny, nx = first["sci"].shape
+        scale = np.array([1.0 / product["expscale"] for product in products])
+
+        phdr = handles[0][0].header.copy()
+        phdr['NDRIZIM'] = (int(offsets[-1]), 'Drizzle, number of images')
+        phdr['EXPTIME'] = (sum(product["exptime"] for product in products),
+                           'Drizzle, total exposure time')
+        phdr['DRIZEXPT'] = (1.0, 'Drizzle, exposure time scaling factor')
+        phdr['DRIZOUUN'] = ('cps', 'Drizzle, units of output image - counts or cps')
+        phdr['DRIZFVAL'] = (fillval, 'Drizzle, fill value for zero weight output pix')
+        phdr['DRIZWHTF'] = ('float32', 'Drizzle, storage of output weighting image')
+        phdr['DRIZCTXF'] = ('int32', 'Drizzle, storage of output context image')
+
+        outsci, outwht, outcon = create_product(outfile, phdr, first,
+                                                (nplane, ny, nx))
+
+        def merge_band(start):
+            stop = min(start + nrows, ny)
+            data = np.empty((len(products), stop - start, nx), dtype=np.float32)
+            weights = np.empty_like(data)
+            for k, product in enumerate(products):
+                data[k] = product["sci"][start:stop]
+                weights[k] = product["wht"][start:stop]
+
+            sci = np.empty((stop - start, nx), dtype=np.float32)
+            wht = np.empty_like(sci)
+            cdrizzle.tmerge(data, weights, scale, sci, wht, fill=fill_value)
+
+            con = np.zeros((nplane, stop - start, nx), dtype=np.int32)
+            for offset, product in zip(offsets, products):
+                context = np.ascontiguousarray(product["con"][:, start:stop],
+                                               dtype=np.int32)
+                cdrizzle.tmerge_context(context, con, offset=int(offset))
+
+            outsci[start:stop] = sci
+            outwht[start:stop] = wht
+            outcon[:, start:stop] = con
+
+        with concurrent.futures.ThreadPoolExecutor(nthreads) as executor:
+            list(executor.map(merge_band, range(0, ny, nrows)))
+
+        for image in (outsci, outwht, outcon):
+            image.flush()
+
+    finally:
+        for handle in handles:
+            handle.close()
+
+
+def create_product(outfile, phdr, product, conshape):
+    """
+    Write the headers of the merged product and return memory maps of
+    its three extensions, initially zero.
+    """
+
+    ny, nx = product["sci"].shape
+    layout = ((product["scihdr"], -32, (ny, nx)),
+              (product["whthdr"], -32, (ny, nx)),
+              (product["conhdr"], 32, conshape))
+
+    offsets = []
+    with open(outfile, "wb") as handle:
+        handle.write(phdr.tostring().encode("ascii"))
+
+        for header, bitpix, shape in layout:
+            header = header.copy()
+            header['BITPIX'] = bitpix
+            for key in ('BSCALE', 'BZERO'):
+                header.remove(key, ignore_missing=True)
+            if len(shape) == 3:
+                header['NAXIS'] = 3
+                header.set('NAXIS3', shape[0], after='NAXIS2')
+
+            handle.write(header.tostring().encode("ascii"))
+            offsets.append(handle.tell())
+
+            # Extend the file over the data, padded to a whole FITS block
+            size = abs(bitpix) // 8 * int(np.prod(shape))
+            size = -(-size // 2880) * 2880
+            handle.seek(size - 1, os.SEEK_CUR)
+            handle.write(b"\0")
+
+    return [np.memmap(outfile, dtype=dtype, mode="r+", offset=offset, shape=shape)
+            for (header, bitpix, shape), dtype, offset in
+            zip(layout, (">f4", ">f4", ">i4"), offsets)]
+
+
+def read_product(handle):
+    """
+    Read the extensions and keywords of a partial product. The images
+    are memory mapped, or if stored in a compact format read and decoded
+    a band of rows at a time as they are indexed.
+    """
+
+    sciext = util.get_keyword(handle, "DRIZOUDA", default="SCI")
+    whtext = util.get_keyword(handle, "DRIZOUWE", default="WHT")
+    ctxext = util.get_keyword(handle, "DRIZOUCO", default="CTX")
+    wht_format = util.get_keyword(handle, "DRIZWHTF", default="float32")
+    ctx_format = util.get_keyword(handle, "DRIZCTXF", default="int32")
+
+    if wht_format == "float32":
+        wht = handle[whtext].data
+    else:
+        wht = writer.WeightBands(handle[whtext], wht_format)
+
+    if ctx_format == "dictionary":
+        con = writer.ContextBands(handle[ctxext], handle[ctxext + "TAB"].data)
+    else:
+        con = handle[ctxext].data
+        if con.ndim == 2:
+            con = con.reshape((1,) + con.shape)
+
+    return {
+        "sci": handle[sciext].data,
+        "wht": wht,
+        "con": con,
+        "scihdr": handle[sciext].header,
+        "whthdr": handle[whtext].header,
+        "conhdr": handle[ctxext].header,
+        "wcs": wcs.WCS(handle[sciext].header),
+        "nimage": int(util.get_keyword(handle, "NDRIZIM",
+                                       default=32 * con.shape[0])),
+        "exptime": float(util.get_keyword(handle, "EXPTIME", default=0.0)),
+        "expscale": float(util.get_keyword(handle, "DRIZEXPT", default=1.0))
+        }
+
+
+def main(argv=None):
+    """
+    Merge partial drizzle products from the command line
+    """
+
+    parser = argparse.ArgumentParser(
+        description="Merge partial drizzle products into a single product")
+    parser.add_argument("outfile", help="the merged product")
+    parser.add_argument("infiles", nargs="+", help="the partial products")
+    parser.add_argument("--fillval", default=None,
+                        help="value of output pixels with no weight")
+    parser.add_argument("--rows", type=int, default=None,
+                        help="number of rows merged at a time")
+    parser.add_argument("--threads", type=int, default=None,
+                        help="number of bands merged in parallel")
+    args = parser.parse_args(argv)
+
+    merge_products(args.infiles, args.outfile, fillval=args.fillval,
+                   nrows=args.rows, nthreads=args.threads)
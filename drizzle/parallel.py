@@ -0,0 +1,419 @@
+"""
+Drizzle images in several worker processes.
+
+Each worker process drizzles the images it is given into its own partial
+output, held in shared memory so the partial outputs never have to be
+copied between processes. When all images have been added the partial
+outputs are merged into a single Drizzle object. Unlike drizzling in
+threads, this does not depend on other Python code releasing the global
+interpreter lock.
+"""
+from __future__ import division, print_function, unicode_literals, absolute_import
+
+import argparse
+import multiprocessing
+import queue
+import time
+import weakref
+from multiprocessing import shared_memory
+
+import numpy as np
+from astropy import wcs
+
+from . import cdrizzle
+from . import drizzle
+
+# Seconds between checks that the workers are running while waiting
+POLL_INTERVAL = 1.0
+
+
+class ParallelDrizzle(object):
+    """
+    Combine images using the drizzle algorithm in several processes
+    """
+    def __init__(self, outwcs, nprocs=None, wt_scl="exptime", pixfrac=1.0,
+                 kernel="square", fillval="INDEF"):
+        """
+        Create the shared partial outputs and start the worker processes.
+
+        Parameters
+        ----------
+
+        outwcs : wcs
+            The world coordinate system (WCS) of the combined image.
+
+        nprocs : int, optional
+            The number of worker processes. The default is the number of
+            processors.
+
+        wt_scl, pixfrac, kernel, fillval : optional
+            The drizzle parameters, as for `Drizzle`.
+
+        The workers and shared memory are released by `finish` or
+        `close`, on leaving a with block, or when the object is garbage
+        collected, whichever comes first.
+        """
+
+        if nprocs is None:
+            nprocs = multiprocessing.cpu_count()
+
+        self.outwcs = outwcs
+        self.nprocs = nprocs
+        self.params = dict(wt_scl=wt_scl, pixfrac=pixfrac, kernel=kernel,
+                           fillval=fillval)
+
+        # One partial output per worker, the context holds 32 images
+        shape = tuple(outwcs.pixel_shape[::-1])
+        self.layout = {"sci": ((nprocs,) + shape, np.float32),
+                       "wht": ((nprocs,) + shape, np.float32),
+                       "con": ((nprocs, 1) + shape, np.int32)}
+
+        # Released even if the caller never reaches finish
+        self.blocks = {}
+        self.images = {}
+        self.workers = []
+        self.finalizer = weakref.finalize(self, release, self.workers,
+                                          self.blocks)
+        for name, (shape, dtype) in self.layout.items():
+            nbytes = int(np.prod(shape)) * np.dtype(dtype).itemsize
+            block = shared_memory.SharedMemory(create=True, size=nbytes)
+            self.blocks[name] = block
+            self.images[name] = np.ndarray(shape, dtype=dtype, buffer=block.buf)
+            self.images[name][...] = 0
+
+        names = dict((name, block.name) for name, block in self.blocks.items())
+
+        self.ntask = 0
+        self.tasks = multiprocessing.Queue(2 * nprocs)
+        self.results = multiprocessing.Queue()
+        for index in range(nprocs):
+            worker = multiprocessing.Process(
+                target=work, args=(index, names, self.layout, outwcs,
+                                   self.params, self.tasks, self.results))
+            worker.daemon = True
+            worker.start()
+            self.workers.append(worker)
+
+
+    def __enter__(self):
+        return self
+
+
+    def __exit__(self, *args):
+        self.close()
+
+
+    def add_image(self, insci, inwcs, **keywords):
+        """
+        Queue an image to be drizzled by the next free worker.
+
+        The image is copied, so it may be changed as soon as this returns.
+        The call waits if the workers have fallen behind, so that queued
+        images do not fill memory. The keywords are those of
+        `Drizzle.add_image`.
+        """
+
+        insci = np.array(insci, dtype=np.float32)
+        if keywords.get("inwht") is not None:
+            keywords["inwht"] = np.array(keywords["inwht"], dtype=np.float32)
+
+        self.put_task("add_image", (insci, inwcs), keywords)
+
+
+    def add_fits_file(self, infile, **keywords):
+        """
+        Queue a file to be read and drizzled by the next free worker.
+
+        Only the file name is sent to the worker. The keywords are those
+        of `Drizzle.add_fits_file`.
+        """
+
+        self.put_task("add_fits_file", (infile,), keywords)
+
+
+    def put_task(self, method, args, keywords):
+        """
+        Queue one call of a Drizzle method, failing if no worker is left
+        to run it.
+        """
+
+        try:
+            self.put((self.ntask, method, args, keywords))
+        except BaseException:
+            self.close()
+            raise
+
+        self.ntask += 1
+
+
+    def put(self, task):
+        """
+        Put a task on the queue, checking the workers are still running
+        while the queue is full.
+        """
+
+        while True:
+            try:
+                self.tasks.put(task, timeout=POLL_INTERVAL)
+                return
+            except queue.Full:
+                self.check_workers()
+                if not any(worker.is_alive() for worker in self.workers):
+                    error = self.receive()
+                    if isinstance(error, BaseException):
+                        raise error
+                    raise RuntimeError("Drizzle workers stopped early")
+
+
+    def receive(self):
+        """
+        Wait for the next result from a worker, checking the workers are
+        still running while none arrives.
+        """
+
+        while True:
+            try:
+                return self.results.get(timeout=POLL_INTERVAL)
+            except queue.Empty:
+                self.check_workers()
+                if not any(worker.is_alive() for worker in self.workers):
+                    raise RuntimeError("Drizzle workers exited without a result")
+
+
+    def check_workers(self):
+        """
+        Raise an error if a worker has died without reporting, as when
+        it crashes or is killed. A worker reporting an error exits
+        normally after putting the error on the result queue.
+        """
+
+        for index, worker in enumerate(self.workers):
+            if worker.exitcode is not None and worker.exitcode != 0:
+                raise RuntimeError("Drizzle worker %d exited with code %d" %
+                                   (index, worker.exitcode))
+
+
+    def finish(self):
+        """
+        Wait for the workers to drizzle every queued image and merge
+        their partial outputs.
+
+        The nth bit of the context image is set for the nth image drizzled,
+        with the images of each worker numbered after those of the workers
+        before it. The queue order of the images is in the `order` field of
+        the returned object.
+
+        Returns
+        -------
+
+        A Drizzle object holding the combined output.
+        """
+
+        try:
+            for worker in self.workers:
+                self.put(None)
+
+            results = [self.receive() for worker in self.workers]
+            for worker in self.workers:
+                worker.join()
+
+            for result in results:
+                if isinstance(result, BaseException):
+                    raise result
+            results.sort(key=lambda result: result["index"])
+
+            driz = self.merge(results)
+
+        finally:
+            self.close()
+
+        return driz
+
+
+    def merge(self, results):
+        """
+        Merge the partial outputs into a new Drizzle object.
+        """
+
+        driz = drizzle.Drizzle(outwcs=self.outwcs, **self.params)
+        driz.order = []
+
+        sci = self.images["sci"]
+        wht = self.images["wht"]
+        outsci = np.zeros(sci.shape[1:], dtype=np.float32)
+        outwht = np.zeros(wht.shape[1:], dtype=np.float32)
+        cdrizzle.tmerge(sci, wht, np.ones(self.nprocs), outsci, outwht)
+
+        nimage = sum(len(result["order"]) for result in results)
+        nplane = max(1, (nimage + 31) // 32)
+        outcon = np.zeros((nplane,) + outsci.shape, dtype=np.int32)
+
+        for result in results:
+            context = result["context"]
+            if context is None:
+                context = self.images["con"][result["index"]]
+            cdrizzle.tmerge_context(context, outcon, offset=len(driz.order))
+            driz.order.extend(result["order"])
+            driz.outexptime += result["outexptime"]
+
+        driz.outsci = outsci
+        driz.outwht = outwht
+        driz.outcon = outcon
+        driz.uniqid = nimage
+        driz._fill_pending = True
+
+        return driz
+
+
+    def close(self):
+        """
+        Stop the workers and release the shared memory. Calling it
+        again does nothing.
+        """
+
+        self.images = {}
+        self.finalizer()
+
+
+def release(workers, blocks):
+    """
+    Stop the workers and unlink the shared memory blocks, emptying both.
+    """
+
+    for worker in workers:
+        if worker.is_alive():
+            worker.terminate()
+        worker.join()
+    del workers[:]
+
+    for block in blocks.values():
+        try:
+            block.close()
+        except BufferError:
+            # A traceback still holds a view of the block
+            pass
+        block.unlink()
+    blocks.clear()
+
+
+def work(index, names, layout, outwcs, params, tasks, results):
+    """
+    Drizzle images into one partial output until told to stop.
+    """
+
+    blocks = []
+    try:
+        images = {}
+        for name, (shape, dtype) in layout.items():
+            block = shared_memory.SharedMemory(name=names[name])
+            blocks.append(block)
+            images[name] = np.ndarray(shape, dtype=dtype,
+                                      buffer=block.buf)[index]
+
+        driz = drizzle.Drizzle(outwcs=outwcs, **params)
+        driz.outsci = images["sci"]
+        driz.outwht = images["wht"]
+        driz.outcon = images["con"]
+
+        order = []
+        for task in iter(tasks.get, None):
+            number, method, args, keywords = task
+            getattr(driz, method)(*args, **keywords)
+            order.append(number)
+
+        # A context that outgrew the shared plane is a private copy
+        context = None
+        if driz.outcon.shape[0] > 1:
+            context = driz.outcon
+
+        result = {"index": index, "order": order, "context": context,
+                  "outexptime": driz.outexptime}
+
+        # Release the views of the shared memory before it is closed
+        del images, driz
+        results.put(result)
+
+    except BaseException as error:
+        results.put(error)
+
+    finally:
+        for block in blocks:
+            try:
+                block.close()
+            except BufferError:
+                pass
+
+
+def benchmark(nimage=16, shape=(1024, 1024), nprocs=None):
+    """
+    Time drizzling a synthetic stack of images with 1 to nprocs workers.
+
+    Each image is random noise with its WCS shifted and rotated slightly
+    from the output WCS. Returns a list of (workers, seconds) pairs.
+    """
+
+    if nprocs is None:
+        nprocs = multiprocessing.cpu_count()
+
+    outwcs = synthetic_wcs(shape, 0.0, 0.0, 0.0)
+    rng = np.random.RandomState(0)
+    stack = [(rng.normal(size=shape).astype(np.float32),
+              synthetic_wcs(shape, rng.uniform(-5, 5), rng.uniform(-5, 5),
+                            rng.uniform(-1, 1)))
+             for i in range(nimage)]
+
+    timings = []
+    for workers in range(1, nprocs + 1):
+        start = time.time()
+        driz = ParallelDrizzle(outwcs, nprocs=workers)
+        for insci, inwcs in stack:
+            driz.add_image(insci, inwcs)
+        driz.finish()
+        timings.append((workers, time.time() - start))
+
+    return timings
+
+
+def synthetic_wcs(shape, dx, dy, angle):
+    """
+    Create a tangent plane WCS with 0.1 arcsecond pixels, offset by
+    (dx, dy) pixels and rotated by angle degrees.
+    """
+
+    ny, nx = shape
+    theta = np.deg2rad(angle)
+    scale = 0.1 / 3600.0
+
+    the_wcs = wcs.WCS(naxis=2)
+    the_wcs.wcs.ctype = ["RA---TAN", "DEC--TAN"]
+    the_wcs.wcs.crpix = [nx / 2.0 + dx, ny / 2.0 + dy]
+    the_wcs.wcs.crval = [150.0, 2.0]
+    the_wcs.wcs.cd = scale * np.array([[-np.cos(theta), np.sin(theta)],
+                                       [np.sin(theta), np.cos(theta)]])
+    the_wcs.pixel_shape = (nx, ny)
+    return the_wcs
+
+
+def main(argv=None):
+    """
+    Run the benchmark from the command line
+    """
+
+    parser = argparse.ArgumentParser(
+        description="Time drizzling a synthetic stack with 1 to N processes")
+    parser.add_argument("--images", type=int, default=16,
+                        help="number of images in the stack")
+    parser.add_argument("--size", type=int, default=1024,
+                        help="number of pixels on a side of each image")
+    parser.add_argument("--procs", type=int, default=None,
+                        help="largest number of worker processes")
+    args = parser.parse_args(argv)
+
+    timings = benchmark(args.images, (args.size, args.size), args.procs)
+    for workers, seconds in timings:
+        print("%3d processes: %8.3f seconds, speedup %5.2f" %
+              (workers, seconds, timings[0][1] / seconds))
+
+
+if __name__ == "__main__":
+    main()
@@ -21,7 +21,9 @@ def get_extensions():
     cdriz_sources = ['cdrizzleapi.c',
                      'cdrizzleblot.c',
                      'cdrizzlebox.c',
+                     'cdrizzlecr.c',
                      'cdrizzlemap.c',
+                     'cdrizzlemerge.c',
                      'cdrizzleutil.c',
                      test_source]
 
@@ -16,34 +16,15 @@
 
 #include "cdrizzleblot.h"
 #include "cdrizzlebox.h"
+#include "cdrizzlecr.h"
 #include "cdrizzlemap.h"
+#include "cdrizzlemerge.h"
 #include "cdrizzleutil.h"
 #include "tests/drizzletest.h"
 
 static PyObject *gl_Error;
 FILE *driz_log_handle = NULL;
 
-/** --------------------------------------------------------------------------------------------------
- * Multiply each pixel in an image by a scale factor
- */
-
-static void
-scale_image(PyArrayObject *image, double scale_factor) {
-  long  i, size;
-  float *imptr;
-
-  assert(image);
-  imptr = (float *) PyArray_DATA(image);
-
-  size = PyArray_DIMS(image)[0] * PyArray_DIMS(image)[1];
-
-  for (i = size; i > 0; --i) {
-    *imptr++ *= scale_factor;
-  }
-
-  return;
-}
-
 /** --------------------------------------------------------------------------------------------------
  * Top level function for drizzling, interfaces with python code
  */
@@ -55,7 +36,9 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
                           "output", "counts", "context",
                           "uniqid", "xmin", "xmax", "ymin", "ymax",
                           "scale", "pixfrac", "kernel", "in_units",
-                          "expscale", "wtscale", "fillstr", NULL};
+                          "expscale", "wtscale", "fillstr", "dirty",
+                          "accumulate", "dq", "bits",
+                          "ivm", "sky", "flat", "dark", "readnoise", NULL};
 
   /* Arguments in the order they appear */
   PyObject *oimg, *owei, *pixmap, *oout, *owht, *ocon;
@@ -71,29 +54,44 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
   float expin = 1.0;
   float wtscl = 1.0;
   char *fillstr = "INDEF";
+  PyObject *odirty = NULL;
+  char *accum_str = "mean";
+  PyObject *odq = NULL, *dq_flags = NULL;
+  unsigned long bits = 0;
+  int ivm = 0;
+  PyObject *osky = NULL;
+  PyObject *oflat = NULL;
+  float dark = 0.0;
+  float readnoise = 0.0;
 
   /* Derived values */
 
   PyArrayObject *img = NULL, *wei = NULL, *out = NULL, *wht = NULL, *con = NULL, *map = NULL;
+  PyArrayObject *dirty = NULL, *dq = NULL, *sky = NULL, *flat = NULL;
+  float sky_value = 0.0;
+  double weight_value = 1.0;
+  int dq_type;
   enum e_kernel_t kernel;
   enum e_unit_t inun;
   char *fillstr_end;
   bool_t do_fill;
   float fill_value;
-  float inv_exposure_time;
+  int istat = 0;
   struct driz_error_t error;
   struct driz_param_t p;
-  integer_t isize[2], psize[2], wsize[2];
+  integer_t isize[2], psize[2], wsize[2], osize[2], dsize[2];
 
   driz_log_handle = driz_log_init(driz_log_handle);
   driz_log_message("starting tdriz");
   driz_error_init(&error);
 
-  if (!PyArg_ParseTupleAndKeywords(args, keywords, "OOOOOO|lllllddssffs:tdriz", (char **)kwlist,
+  if (!PyArg_ParseTupleAndKeywords(args, keywords, "OOOOOO|lllllddssffsOsOkiOOff:tdriz", (char **)kwlist,
                         &oimg, &owei, &pixmap, &oout, &owht, &ocon, /* OOOOOO */
                         &uniqid, &xmin, &xmax, &ymin, &ymax,  /* lllll */
                         &scale, &pfract, &kernel_str, &inun_str, /* ddss */
-                        &expin, &wtscl,  &fillstr) /* ffs */
+                        &expin, &wtscl,  &fillstr, &odirty, &accum_str, /* ffsOs */
+                        &odq, &bits, /* Ok */
+                        &ivm, &osky, &oflat, &dark, &readnoise) /* iOOff */
                        ) {
     return NULL;
   }
@@ -105,10 +103,22 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
     goto _exit;
   }
 
-  wei = (PyArrayObject *)PyArray_ContiguousFromAny(owei, NPY_FLOAT, 2, 2);
-  if (!wei) {
-    driz_error_set_message(&error, "Invalid weights array");
-    goto _exit;
+  /* Without weights every pixel has the weight scale, a single weight
+     is folded into it */
+  if (PyArray_IsAnyScalar(owei)) {
+    weight_value = PyFloat_AsDouble(owei);
+    if (PyErr_Occurred()) {
+      PyErr_Clear();
+      driz_error_set_message(&error, "Invalid weights value");
+      goto _exit;
+    }
+
+  } else if (owei != Py_None) {
+    wei = (PyArrayObject *)PyArray_ContiguousFromAny(owei, NPY_FLOAT, 2, 2);
+    if (!wei) {
+      driz_error_set_message(&error, "Invalid weights array");
+      goto _exit;
+    }
   }
 
   map = (PyArrayObject *)PyArray_ContiguousFromAny(pixmap, NPY_DOUBLE, 3, 3);
@@ -135,6 +145,95 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
     goto _exit;
   }
 
+  if (odirty && odirty != Py_None) {
+    dirty = (PyArrayObject *)PyArray_ContiguousFromAny(odirty, NPY_UBYTE, 2, 2);
+    if (!dirty) {
+      driz_error_set_message(&error, "Invalid dirty tile array");
+      goto _exit;
+    }
+
+    get_dimensions(out, osize);
+    get_dimensions(dirty, dsize);
+    if (dsize[0] != (osize[0] + DRIZ_TILE_SIZE - 1) / DRIZ_TILE_SIZE ||
+        dsize[1] != (osize[1] + DRIZ_TILE_SIZE - 1) / DRIZ_TILE_SIZE) {
+      driz_error_set_message(&error, "Dirty tile array does not match output tiles");
+      goto _exit;
+    }
+  }
+
+  /* Data quality flags are read as uint16 if they fit, otherwise uint32.
+     Signed flags, as read from a FITS image without BZERO, are the same
+     bits and are viewed as unsigned rather than rejected by the cast. */
+  if (odq && odq != Py_None) {
+    dq_type = NPY_UINT32;
+    dq_flags = odq;
+    Py_INCREF(dq_flags);
+
+    if (PyArray_Check(odq)) {
+      PyArrayObject *arr = (PyArrayObject *)odq;
+      int itemsize = (int)PyArray_ITEMSIZE(arr);
+
+      if (!PyArray_ISINTEGER(arr) || itemsize > 4) {
+        driz_error_set_message(&error, "Data quality array must hold 8, 16 or 32 bit integers");
+        goto _exit;
+      }
+
+      if (itemsize <= 2) {
+        dq_type = NPY_UINT16;
+      }
+
+      if (PyArray_ISSIGNED(arr)) {
+        PyArray_Descr *descr = PyArray_DescrFromType(itemsize == 1 ? NPY_UINT8 :
+                                                     itemsize == 2 ? NPY_UINT16 : NPY_UINT32);
+        if (!PyArray_ISNOTSWAPPED(arr)) {
+          PyArray_Descr *swapped = PyArray_DescrNewByteorder(descr, NPY_SWAP);
+          Py_DECREF(descr);
+          descr = swapped;
+        }
+
+        Py_DECREF(dq_flags);
+        dq_flags = PyArray_View(arr, descr, NULL);
+        if (!dq_flags) {
+          driz_error_set_message(&error, "Invalid data quality array");
+          goto _exit;
+        }
+      }
+    }
+
+    dq = (PyArrayObject *)PyArray_ContiguousFromAny(dq_flags, dq_type, 2, 2);
+    if (!dq) {
+      driz_error_set_message(&error, "Invalid data quality array");
+      goto _exit;
+    }
+  }
+
+  /* The sky of inverse variance weighting is a number or an image */
+  if (osky && osky != Py_None) {
+    if (PyArray_Check(osky) && PyArray_NDIM((PyArrayObject *)osky) > 0) {
+      sky = (PyArrayObject *)PyArray_ContiguousFromAny(osky, NPY_FLOAT, 2, 2);
+      if (!sky) {
+        driz_error_set_message(&error, "Invalid sky array");
+        goto _exit;
+      }
+
+    } else {
+      sky_value = (float) PyFloat_AsDouble(osky);
+      if (PyErr_Occurred()) {
+        PyErr_Clear();
+        driz_error_set_message(&error, "Sky must be a number or an array");
+        goto _exit;
+      }
+    }
+  }
+
+  if (oflat && oflat != Py_None) {
+    flat = (PyArrayObject *)PyArray_ContiguousFromAny(oflat, NPY_FLOAT, 2, 2);
+    if (!flat) {
+      driz_error_set_message(&error, "Invalid flat field array");
+      goto _exit;
+    }
+  }
+
   /* Convert t`he fill value string */
 
   if (fillstr == NULL ||
@@ -181,21 +280,23 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
     kernel_str2enum("point", &kernel, &error);
   }
 
-  /* If the input image is not in CPS we need to divide by the exposure */
-  if (inun != unit_cps) {
-    inv_exposure_time = 1.0f / p.exposure_time;
-    scale_image(img, inv_exposure_time);
-  }
-
   /* Setup reasonable defaults for drizzling */
   driz_param_init(&p);
 
   p.data = img;
   p.weights = wei;
   p.pixmap = map;
+  p.dq = dq;
+  p.dq_bits = (npy_uint32) bits;
+  p.ivm = ivm != 0;
+  p.ivm_sky = sky_value;
+  p.ivm_noise = dark + readnoise * readnoise;
+  p.ivm_sky_map = sky;
+  p.ivm_flat = flat;
   p.output_data = out;
   p.output_counts = wht;
   p.output_context = con;
+  p.output_dirty = dirty;
   p.uuid = uniqid;
   p.xmin = xmin;
   p.ymin = ymin;
@@ -206,17 +307,27 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
   p.kernel = kernel;
   p.in_units = inun;
   p.exposure_time = expin;
-  p.weight_scale = wtscl;
+  p.weight_scale = wtscl * weight_value;
   p.fill_value = fill_value;
   p.error = &error;
 
+  /* The output holds the weighted mean, or the weighted sum to be
+     divided by the weights once drizzling is done */
+  if (strcmp(accum_str, "sum") == 0) {
+    p.sum_data = 1;
+  } else if (strcmp(accum_str, "mean") != 0) {
+    driz_error_set_message(&error, "Unknown accumulation, must be mean or sum");
+    goto _exit;
+  }
+
   if (driz_error_check(&error, "xmin must be >= 0", p.xmin >= 0)) goto _exit;
   if (driz_error_check(&error, "ymin must be >= 0", p.ymin >= 0)) goto _exit;
   if (driz_error_check(&error, "xmax must be > xmin", p.xmax > p.xmin)) goto _exit;
   if (driz_error_check(&error, "ymax must be > ymin", p.ymax > p.ymin)) goto _exit;
   if (driz_error_check(&error, "scale must be > 0", p.scale > 0.0)) goto _exit;
   if (driz_error_check(&error, "exposure time must be > 0", p.exposure_time)) goto _exit;
-  if (driz_error_check(&error, "weight scale must be > 0", p.weight_scale > 0.0)) goto _exit;
+  if (driz_error_check(&error, "weight scale must be > 0", wtscl > 0.0)) goto _exit;
+  if (driz_error_check(&error, "weights value must be > 0", weight_value > 0.0)) goto _exit;
 
   get_dimensions(p.pixmap, psize);
   if (psize[0] != isize[0] || psize[1] != isize[1]) {
@@ -232,7 +343,41 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
     }
   }
 
-  if (dobox(&p)) {
+  if (p.dq) {
+    get_dimensions(p.dq, wsize);
+    if (wsize[0] != isize[0] || wsize[1] != isize[1]) {
+      driz_error_set_message(&error, "Data quality array dimensions != input dimensions");
+      goto _exit;
+    }
+  }
+
+  if (p.ivm) {
+    if (driz_error_check(&error, "dark plus read noise squared must be > 0",
+                         p.ivm_noise > 0.0)) goto _exit;
+
+    if (p.ivm_sky_map) {
+      get_dimensions(p.ivm_sky_map, wsize);
+      if (wsize[0] != isize[0] || wsize[1] != isize[1]) {
+        driz_error_set_message(&error, "Sky array dimensions != input dimensions");
+        goto _exit;
+      }
+    }
+
+    if (p.ivm_flat) {
+      get_dimensions(p.ivm_flat, wsize);
+      if (wsize[0] != isize[0] || wsize[1] != isize[1]) {
+        driz_error_set_message(&error, "Flat field array dimensions != input dimensions");
+        goto _exit;
+      }
+    }
+  }
+
+  /* Drizzling touches no Python objects, let other threads run */
+  Py_BEGIN_ALLOW_THREADS
+  istat = dobox(&p);
+  Py_END_ALLOW_THREADS
+
+  if (istat) {
     goto _exit;
   }
 
@@ -250,12 +395,17 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
   Py_XDECREF(out);
   Py_XDECREF(wht);
   Py_XDECREF(map);
+  Py_XDECREF(dirty);
+  Py_XDECREF(dq);
+  Py_XDECREF(dq_flags);
+  Py_XDECREF(sky);
+  Py_XDECREF(flat);
 
   if (driz_error_is_set(&error)) {
     PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
     return NULL;
   } else {
-    return Py_BuildValue("sii", "Callable C-based DRIZZLE Version 1.12 (28th June 2018)", p.nmiss, p.nskip);
+    return Py_BuildValue("snn", "Callable C-based DRIZZLE Version 1.12 (28th June 2018)", p.nmiss, p.nskip);
   }
 }
 
@@ -269,7 +419,7 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords)
   const char *kwlist[] = {"source", "pixmap", "output",
                           "xmin", "xmax", "ymin", "ymax",
                           "scale", "kscale", "interp", "exptime",
-                          "misval", "sinscl", NULL};
+                          "misval", "sinscl", "dirty", NULL};
 
   /* Arguments in the order they appear */
   PyObject *oimg, *pixmap, *oout;
@@ -283,28 +433,31 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords)
   float ef = 1.0;
   float misval = 0.0;
   float sinscl = 1.0;
+  PyObject *odirty = NULL;
 
-  PyArrayObject *img = NULL, *out = NULL, *map = NULL;
+  PyArrayObject *img = NULL, *out = NULL, *map = NULL, *dirty = NULL;
+  PyArrayObject **img_planes = NULL, **out_planes = NULL;
+  npy_intp k, nplane = 0;
   enum e_interp_t interp;
   int istat = 0;
   struct driz_error_t error;
   struct driz_param_t p;
-  integer_t psize[2], osize[2];
+  integer_t psize[2], osize[2], isize[2], dsize[2];
 
   driz_log_handle = driz_log_init(driz_log_handle);
   driz_log_message("starting tblot");
   driz_error_init(&error);
 
-  if (!PyArg_ParseTupleAndKeywords(args, keywords, "OOO|lllldfsfff:tblot", (char **)kwlist,
+  if (!PyArg_ParseTupleAndKeywords(args, keywords, "OOO|lllldfsfffO:tblot", (char **)kwlist,
                         &oimg, &pixmap, &oout, /* OOO */
                         &xmin, &xmax, &ymin, &ymax, /* llll */
                         &scale, &kscale, &interp_str, &ef, /* dfsf */
-                        &misval, &sinscl) /* ff */
+                        &misval, &sinscl, &odirty) /* ffO */
                        ){
     return NULL;
   }
 
-  img = (PyArrayObject *)PyArray_ContiguousFromAny(oimg, NPY_FLOAT, 2, 2);
+  img = (PyArrayObject *)PyArray_ContiguousFromAny(oimg, NPY_FLOAT, 2, 3);
   if (!img) {
     driz_error_set_message(&error, "Invalid input array");
     goto _exit;
@@ -316,18 +469,66 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords)
     goto _exit;
   }
 
-  out = (PyArrayObject *)PyArray_ContiguousFromAny(oout, NPY_FLOAT, 2, 2);
+  out = (PyArrayObject *)PyArray_ContiguousFromAny(oout, NPY_FLOAT, 2, 3);
   if (!out) {
     driz_error_set_message(&error, "Invalid output array");
     goto _exit;
   }
 
+  /* A stack of images is blotted plane by plane into a stack of outputs */
+  if (PyArray_NDIM(img) != PyArray_NDIM(out)) {
+    driz_error_set_message(&error, "Input and output arrays must both be images or both be stacks");
+    goto _exit;
+  }
+
+  if (PyArray_NDIM(img) == 3) {
+    nplane = PyArray_DIM(img, 0);
+    if (nplane == 0 || PyArray_DIM(out, 0) != nplane) {
+      driz_error_set_message(&error, "Input and output stacks must have the same number of planes");
+      goto _exit;
+    }
+
+    img_planes = (PyArrayObject **)calloc(nplane, sizeof(PyArrayObject *));
+    out_planes = (PyArrayObject **)calloc(nplane, sizeof(PyArrayObject *));
+    if (!img_planes || !out_planes) {
+      driz_error_set_message(&error, "Out of memory");
+      goto _exit;
+    }
+
+    for (k = 0; k < nplane; ++k) {
+      img_planes[k] = (PyArrayObject *)PyArray_SimpleNewFromData(
+        2, PyArray_DIMS(img) + 1, NPY_FLOAT, PyArray_GETPTR3(img, k, 0, 0));
+      out_planes[k] = (PyArrayObject *)PyArray_SimpleNewFromData(
+        2, PyArray_DIMS(out) + 1, NPY_FLOAT, PyArray_GETPTR3(out, k, 0, 0));
+      if (!img_planes[k] || !out_planes[k]) {
+        driz_error_set_message(&error, "Out of memory");
+        goto _exit;
+      }
+    }
+  }
+
+  if (odirty && odirty != Py_None) {
+    dirty = (PyArrayObject *)PyArray_ContiguousFromAny(odirty, NPY_UBYTE, 2, 2);
+    if (!dirty) {
+      driz_error_set_message(&error, "Invalid dirty tile array");
+      goto _exit;
+    }
+
+    get_dimensions(img_planes ? img_planes[0] : img, isize);
+    get_dimensions(dirty, dsize);
+    if (dsize[0] != (isize[0] + DRIZ_TILE_SIZE - 1) / DRIZ_TILE_SIZE ||
+        dsize[1] != (isize[1] + DRIZ_TILE_SIZE - 1) / DRIZ_TILE_SIZE) {
+      driz_error_set_message(&error, "Dirty tile array does not match input tiles");
+      goto _exit;
+    }
+  }
+
   if (interp_str2enum(interp_str, &interp, &error)) {
     goto _exit;
   }
 
   get_dimensions(map, psize);
-  get_dimensions(out, osize);
+  get_dimensions(out_planes ? out_planes[0] : out, osize);
 
   if (psize[0] != osize[0] || psize[1] != osize[1]) {
     driz_error_set_message(&error, "Pixel map dimensions != output dimensions");
@@ -339,8 +540,13 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords)
 
   driz_param_init(&p);
 
-  p.data = img;
-  p.output_data = out;
+  p.data = img_planes ? img_planes[0] : img;
+  p.output_data = out_planes ? out_planes[0] : out;
+  if (img_planes) {
+    p.nplane = nplane;
+    p.data_planes = img_planes;
+    p.output_planes = out_planes;
+  }
   p.xmin = xmin;
   p.xmax = xmax;
   p.ymin = ymin;
@@ -353,6 +559,7 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords)
   p.misval = misval;
   p.sinscl = sinscl;
   p.pixmap = map;
+  p.data_dirty = dirty;
   p.error = &error;
 
   if (driz_error_check(&error, "xmin must be >= 0", p.xmin >= 0)) goto _exit;
@@ -363,14 +570,26 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords)
   if (driz_error_check(&error, "kscale must be > 0", p.kscale > 0.0)) goto _exit;
   if (driz_error_check(&error, "exposure time must be > 0", p.ef > 0.0)) goto _exit;
 
-  if (doblot(&p)) goto _exit;
+  /* Blotting touches no Python objects, let other threads run */
+  Py_BEGIN_ALLOW_THREADS
+  istat = doblot(&p);
+  Py_END_ALLOW_THREADS
+
+  if (istat) goto _exit;
 
  _exit:
   driz_log_message("ending tblot");
   driz_log_close(driz_log_handle);
-  Py_DECREF(img);
-  Py_DECREF(out);
-  Py_DECREF(map);
+  for (k = 0; k < nplane; ++k) {
+    if (img_planes) Py_XDECREF(img_planes[k]);
+    if (out_planes) Py_XDECREF(out_planes[k]);
+  }
+  if (img_planes) free(img_planes);
+  if (out_planes) free(out_planes);
+  Py_XDECREF(img);
+  Py_XDECREF(out);
+  Py_XDECREF(map);
+  Py_XDECREF(dirty);
 
   if (driz_error_is_set(&error)) {
     if (strcmp(driz_error_get_message(&error), "<PYTHON>") != 0)
@@ -382,6 +601,300 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords)
 }
 
 
+/** --------------------------------------------------------------------------------------------------
+ * Top level function for flagging cosmic rays, interfaces with python code
+ */
+
+static PyObject *
+tcrmask(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
+{
+  const char *kwlist[] = {"data", "model", "mask", "ystart", "ystop",
+                          "gain", "readnoise", "exptime", "sky",
+                          "snr1", "snr2", "scale1", "scale2", "grow", NULL};
+
+  /* Arguments in the order they appear */
+  PyObject *odat, *omod, *omsk;
+  long ystart = 0;
+  long ystop = 0;
+  long grow = 0;
+  struct cr_param_t cr;
+
+  PyArrayObject *dat = NULL, *mod = NULL, *msk = NULL;
+  struct driz_error_t error;
+  int istat = 0;
+
+  driz_error_init(&error);
+
+  cr.gain = 1.0;
+  cr.readnoise = 0.0;
+  cr.exptime = 1.0;
+  cr.sky = 0.0;
+  cr.snr1 = 3.5;
+  cr.snr2 = 3.0;
+  cr.scale1 = 2.0;
+  cr.scale2 = 1.5;
+
+  if (!PyArg_ParseTupleAndKeywords(args, keywords, "OOO|llffffffffl:tcrmask", (char **)kwlist,
+                        &odat, &omod, &omsk, &ystart, &ystop, /* OOOll */
+                        &cr.gain, &cr.readnoise, &cr.exptime, &cr.sky, /* ffff */
+                        &cr.snr1, &cr.snr2, &cr.scale1, &cr.scale2, &grow) /* ffffl */
+                       ){
+    return NULL;
+  }
+
+  dat = (PyArrayObject *)PyArray_ContiguousFromAny(odat, NPY_FLOAT, 2, 2);
+  if (!dat) {
+    driz_error_set_message(&error, "Invalid data array");
+    goto _exit;
+  }
+
+  mod = (PyArrayObject *)PyArray_ContiguousFromAny(omod, NPY_FLOAT, 2, 2);
+  if (!mod) {
+    driz_error_set_message(&error, "Invalid model array");
+    goto _exit;
+  }
+
+  msk = (PyArrayObject *)PyArray_ContiguousFromAny(omsk, NPY_UBYTE, 2, 2);
+  if (!msk) {
+    driz_error_set_message(&error, "Invalid mask array");
+    goto _exit;
+  }
+
+  if (ystop == 0) ystop = PyArray_DIM(dat, 0);
+  if (driz_error_check(&error, "grow must be >= 0", grow >= 0)) goto _exit;
+  cr.grow = (integer_t)grow;
+
+  /* Masking touches no Python objects, let other threads run */
+  Py_BEGIN_ALLOW_THREADS
+  istat = cr_mask(dat, mod, msk, &cr, (integer_t)ystart, (integer_t)ystop, &error);
+  Py_END_ALLOW_THREADS
+
+ _exit:
+  Py_XDECREF(dat);
+  Py_XDECREF(mod);
+  Py_XDECREF(msk);
+
+  if (driz_error_is_set(&error)) {
+    PyErr_SetString(PyExc_Exception, driz_error_get_message(&error));
+    return NULL;
+  } else {
+    return Py_BuildValue("i",istat);
+  }
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Top level function for merging drizzled images, interfaces with python code
+ */
+
+static PyObject *
+tmerge(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
+{
+  const char *kwlist[] = {"data", "weights", "scale",
+                          "output", "outweight", "fill", NULL};
+
+  /* Arguments in the order they appear */
+  PyObject *odat, *owei, *oscl, *oout, *owht;
+  float fill = 0.0;
+
+  PyArrayObject *dat = NULL, *wei = NULL, *scl = NULL, *out = NULL, *wht = NULL;
+  struct driz_error_t error;
+  int istat = 0;
+
+  driz_error_init(&error);
+
+  if (!PyArg_ParseTupleAndKeywords(args, keywords, "OOOOO|f:tmerge", (char **)kwlist,
+                        &odat, &owei, &oscl, &oout, &owht, &fill) /* OOOOOf */
+                       ){
+    return NULL;
+  }
+
+  dat = (PyArrayObject *)PyArray_ContiguousFromAny(odat, NPY_FLOAT, 3, 3);
+  if (!dat) {
+    driz_error_set_message(&error, "Invalid data array");
+    goto _exit;
+  }
+
+  wei = (PyArrayObject *)PyArray_ContiguousFromAny(owei, NPY_FLOAT, 3, 3);
+  if (!wei) {
+    driz_error_set_message(&error, "Invalid weights array");
+    goto _exit;
+  }
+
+  scl = (PyArrayObject *)PyArray_ContiguousFromAny(oscl, NPY_DOUBLE, 1, 1);
+  if (!scl) {
+    driz_error_set_message(&error, "Invalid scale array");
+    goto _exit;
+  }
+
+  out = (PyArrayObject *)PyArray_ContiguousFromAny(oout, NPY_FLOAT, 2, 2);
+  if (!out) {
+    driz_error_set_message(&error, "Invalid output array");
+    goto _exit;
+  }
+
+  wht = (PyArrayObject *)PyArray_ContiguousFromAny(owht, NPY_FLOAT, 2, 2);
+  if (!wht) {
+    driz_error_set_message(&error, "Invalid outweight array");
+    goto _exit;
+  }
+
+  if (PyArray_SIZE(scl) != PyArray_DIM(dat, 0)) {
+    driz_error_set_message(&error, "Scale array length != number of images");
+    goto _exit;
+  }
+
+  /* The merge touches no Python objects, let other threads run */
+  Py_BEGIN_ALLOW_THREADS
+  istat = merge_weighted(dat, wei, (const double *)PyArray_DATA(scl),
+                         out, wht, fill, &error);
+  Py_END_ALLOW_THREADS
+
+ _exit:
+  Py_XDECREF(dat);
+  Py_XDECREF(wei);
+  Py_XDECREF(scl);
+  Py_XDECREF(out);
+  Py_XDECREF(wht);
+
+  if (driz_error_is_set(&error)) {
+    PyErr_SetString(PyExc_Exception, driz_error_get_message(&error));
+    return NULL;
+  } else {
+    return Py_BuildValue("i",istat);
+  }
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Top level function for the median of drizzled images, interfaces with python code
+ */
+
+static PyObject *
+tmedian(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
+{
+  const char *kwlist[] = {"data", "weights", "output", "combine",
+                          "nsigma", "gain", "readnoise", "fill", NULL};
+
+  /* Arguments in the order they appear */
+  PyObject *odat, *owei, *oout;
+  char *combine_str = "median";
+  float nsigma = 4.0;
+  float gain = 1.0;
+  float readnoise = 0.0;
+  float fill = 0.0;
+  int minmed;
+
+  PyArrayObject *dat = NULL, *wei = NULL, *out = NULL;
+  struct driz_error_t error;
+  int istat = 0;
+
+  driz_error_init(&error);
+
+  if (!PyArg_ParseTupleAndKeywords(args, keywords, "OOO|sffff:tmedian", (char **)kwlist,
+                        &odat, &owei, &oout, &combine_str, /* OOOs */
+                        &nsigma, &gain, &readnoise, &fill) /* ffff */
+                       ){
+    return NULL;
+  }
+
+  if (strcmp(combine_str, "median") == 0) {
+    minmed = 0;
+  } else if (strcmp(combine_str, "minmed") == 0) {
+    minmed = 1;
+  } else {
+    driz_error_set_message(&error, "Unknown combination, must be median or minmed");
+    goto _exit;
+  }
+
+  dat = (PyArrayObject *)PyArray_ContiguousFromAny(odat, NPY_FLOAT, 3, 3);
+  if (!dat) {
+    driz_error_set_message(&error, "Invalid data array");
+    goto _exit;
+  }
+
+  wei = (PyArrayObject *)PyArray_ContiguousFromAny(owei, NPY_FLOAT, 3, 3);
+  if (!wei) {
+    driz_error_set_message(&error, "Invalid weights array");
+    goto _exit;
+  }
+
+  out = (PyArrayObject *)PyArray_ContiguousFromAny(oout, NPY_FLOAT, 2, 2);
+  if (!out) {
+    driz_error_set_message(&error, "Invalid output array");
+    goto _exit;
+  }
+
+  /* The median touches no Python objects, let other threads run */
+  Py_BEGIN_ALLOW_THREADS
+  istat = merge_median(dat, wei, out, minmed, nsigma, gain, readnoise, fill, &error);
+  Py_END_ALLOW_THREADS
+
+ _exit:
+  Py_XDECREF(dat);
+  Py_XDECREF(wei);
+  Py_XDECREF(out);
+
+  if (driz_error_is_set(&error)) {
+    PyErr_SetString(PyExc_Exception, driz_error_get_message(&error));
+    return NULL;
+  } else {
+    return Py_BuildValue("i",istat);
+  }
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Top level function for merging context images, interfaces with python code
+ */
+
+static PyObject *
+tmerge_context(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords)
+{
+  const char *kwlist[] = {"context", "output", "offset", NULL};
+
+  /* Arguments in the order they appear */
+  PyObject *ocon, *oout;
+  long offset = 0;
+
+  PyArrayObject *con = NULL, *out = NULL;
+  struct driz_error_t error;
+  int istat = 0;
+
+  driz_error_init(&error);
+
+  if (!PyArg_ParseTupleAndKeywords(args, keywords, "OO|l:tmerge_context", (char **)kwlist,
+                        &ocon, &oout, &offset) /* OOl */
+                       ){
+    return NULL;
+  }
+
+  con = (PyArrayObject *)PyArray_ContiguousFromAny(ocon, NPY_INT32, 3, 3);
+  if (!con) {
+    driz_error_set_message(&error, "Invalid context array");
+    goto _exit;
+  }
+
+  out = (PyArrayObject *)PyArray_ContiguousFromAny(oout, NPY_INT32, 3, 3);
+  if (!out) {
+    driz_error_set_message(&error, "Invalid output array");
+    goto _exit;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  istat = merge_context(con, out, (integer_t)offset, &error);
+  Py_END_ALLOW_THREADS
+
+ _exit:
+  Py_XDECREF(con);
+  Py_XDECREF(out);
+
+  if (driz_error_is_set(&error)) {
+    PyErr_SetString(PyExc_Exception, driz_error_get_message(&error));
+    return NULL;
+  } else {
+    return Py_BuildValue("i",istat);
+  }
+}
+
+
 /** --------------------------------------------------------------------------------------------------
  * Top level of C unit tests, interfaces with python code
  */
@@ -442,9 +955,18 @@ test_cdrizzle(PyObject *self, PyObject *args)
 
 static struct PyMethodDef cdrizzle_methods[] = {
     {"tdriz",  (PyCFunction)tdriz, METH_VARARGS|METH_KEYWORDS,
-    "tdriz(image, weight, output, outweight, context, uniqid,  xmin, ymin, scale, pfract, kernel, inun, expin, wtscl, fill, nmiss, nskip, pixmap)"},
+    "tdriz(image, weight, output, outweight, context, uniqid,  xmin, ymin, scale, pfract, kernel, inun, expin, wtscl, fill, nmiss, nskip, pixmap, dirty, accumulate, dq, bits, ivm, sky, flat, dark, readnoise)"},
     {"tblot",  (PyCFunction)tblot, METH_VARARGS|METH_KEYWORDS,
-    "tblot(image, output, xmin, xmax, ymin, ymax, scale, kscale, interp, ef, misval, sinscl, pixmap)"},
+    "tblot(image, output, xmin, xmax, ymin, ymax, scale, kscale, interp, ef, misval, sinscl, pixmap, dirty)\n\n"
+     "image and output may be stacks of images, blotted plane by plane through the same pixmap."},
+    {"tcrmask",  (PyCFunction)tcrmask, METH_VARARGS|METH_KEYWORDS,
+    "tcrmask(data, model, mask, ystart, ystop, gain, readnoise, exptime, sky, snr1, snr2, scale1, scale2, grow)"},
+    {"tmerge",  (PyCFunction)tmerge, METH_VARARGS|METH_KEYWORDS,
+    "tmerge(data, weights, scale, output, outweight, fill)"},
+    {"tmedian",  (PyCFunction)tmedian, METH_VARARGS|METH_KEYWORDS,
+    "tmedian(data, weights, output, combine, nsigma, gain, readnoise, fill)"},
+    {"tmerge_context",  (PyCFunction)tmerge_context, METH_VARARGS|METH_KEYWORDS,
+    "tmerge_context(context, output, offset)"},
     {"test_cdrizzle", test_cdrizzle, METH_VARARGS,
     "test_cdrizzle(data, weights, pixmap, output_data, output_counts)"},
     {NULL,        NULL}        /* sentinel */
@@ -456,14 +978,18 @@ static struct PyMethodDef cdrizzle_methods[] = {
 #if PY_MAJOR_VERSION < 3
 PyMODINIT_FUNC initcdrizzle(void)
 {
+    PyObject *m;
+
     /* Create the module and add the functions */
-    (void) Py_InitModule("cdrizzle", cdrizzle_methods);
+    m = Py_InitModule("cdrizzle", cdrizzle_methods);
 
     /* Check for errors */
     if (PyErr_Occurred())
         Py_FatalError("can't initialize module cdrizzle");
 
     import_array();
+
+    PyModule_AddIntConstant(m, "DRIZ_TILE_SIZE", DRIZ_TILE_SIZE);
 }
 
 #else
@@ -489,6 +1015,8 @@ PyMODINIT_FUNC *PyInit_cdrizzle(void)
         Py_FatalError("can't initialize module cdrizzle");
 
     import_array();
+
+    PyModule_AddIntConstant(m, "DRIZ_TILE_SIZE", DRIZ_TILE_SIZE);
     return m;
 }
 
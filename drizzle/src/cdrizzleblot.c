@@ -251,6 +251,290 @@ ii_bipoly5(const float* coeff /* [len_coeff][len_coeff] */,
   }
 }
 
+/** --------------------------------------------------------------------------------------------------
+ * A ring of rows holding the central differences in x along rows of the input images, for
+ * polynomial interpolation. Input row j is held in slot j % nrows, and the differences of a
+ * row are computed when the row is first used after it was loaded into its slot, so each is
+ * computed once rather than once for every output pixel that reads it. The ring only covers
+ * the input rows read by neighbouring output rows, so its size does not grow with the input
+ * image. The planes of a stack share the ring, since they read the same rows.
+ */
+
+struct poly_ring_t {
+  /* Number of points on a side of the interpolant, 4 or 6 */
+  integer_t nterms;
+  /* Number of rows in the ring, and of planes and pixels in each row */
+  integer_t nrows, nplane, width;
+  /* The input images */
+  PyArrayObject** sources;
+  /* The input row held by each slot, or -1 */
+  integer_t* row;
+  /* Second and fourth central differences, divided by 6 and 120, [nplane][nrows][width] */
+  float *cd2;
+  float *cd4;
+};
+
+/** --------------------------------------------------------------------------------------------------
+ * The state of polynomial interpolation of one plane. The values read for the last cell
+ * interpolated are kept, so a run of output pixels falling in the same cell reads them once.
+ */
+
+struct poly_param_t {
+  /* The shared row tables and the plane of this state */
+  struct poly_ring_t* ring;
+  integer_t plane;
+  /* The last cell interpolated and the values read for it */
+  integer_t cx, cy;
+  float z0[6], z1[6], c20[6], c21[6], c40[6], c41[6];
+};
+
+/** --------------------------------------------------------------------------------------------------
+ * Find the number of rows the ring needs, from the range of input rows read by each pair of
+ * neighbouring output rows. Points off the input image are not interpolated and are ignored.
+ *
+ * p:      structure containing options, input, and output
+ * nterms: the number of points on a side of the interpolant
+ * isize:  the dimensions of the input image
+ * osize:  the dimensions of the output image
+ */
+
+static integer_t
+poly_ring_rows(struct driz_param_t* p, const integer_t nterms,
+               const integer_t isize[2], const integer_t osize[2]) {
+  integer_t i, j, iy, lo, hi, prevlo, prevhi, span = 0;
+  float yo;
+
+  prevlo = isize[1];
+  prevhi = -1;
+  for (j = 0; j < osize[1]; ++j) {
+    lo = isize[1];
+    hi = -1;
+    for (i = 0; i < osize[0]; ++i) {
+      yo = get_pixmap(p->pixmap, i, j)[1];
+      if (! (yo >= 0.0f && yo < (float)isize[1])) continue;
+      iy = (integer_t)yo;
+      if (iy < lo) lo = iy;
+      if (iy > hi) hi = iy;
+    }
+
+    if (hi >= 0) {
+      span = MAX(span, MAX(hi, prevhi) - MIN(lo, prevlo) + 1);
+    }
+    prevlo = lo;
+    prevhi = hi;
+  }
+
+  /* The cell of a point reads rows on either side of it */
+  return MIN(span + nterms + 2, isize[1]);
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Allocate the row tables for polynomial interpolation
+ *
+ * ring:    the structure to initialize
+ * nterms:  the number of points on a side of the interpolant, 4 or 6
+ * nrows:   the number of rows in the ring
+ * nplane:  the number of input images
+ * sources: the input images
+ * isize:   the dimensions of the input images
+ */
+
+static int
+init_poly_ring(struct poly_ring_t* ring, const integer_t nterms, const integer_t nrows,
+               const integer_t nplane, PyArrayObject** sources, const integer_t isize[2]) {
+  size_t npix = (size_t)nplane * (size_t)nrows * (size_t)isize[0];
+  integer_t k;
+
+  ring->nterms = nterms;
+  ring->nrows = nrows;
+  ring->nplane = nplane;
+  ring->width = isize[0];
+  ring->sources = sources;
+  ring->row = (integer_t*)malloc(nrows * sizeof(integer_t));
+  ring->cd2 = (float*)malloc(npix * sizeof(float));
+  ring->cd4 = nterms > 4 ? (float*)malloc(npix * sizeof(float)) : NULL;
+
+  if (ring->row == NULL || ring->cd2 == NULL || (nterms > 4 && ring->cd4 == NULL)) {
+    return 1;
+  }
+
+  for (k = 0; k < nrows; ++k) {
+    ring->row[k] = -1;
+  }
+  return 0;
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Free the row tables for polynomial interpolation
+ */
+
+static void
+free_poly_ring(struct poly_ring_t* ring) {
+  if (ring->row) free(ring->row);
+  if (ring->cd2) free(ring->cd2);
+  if (ring->cd4) free(ring->cd4);
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Load one row of the input images into its slot of the ring, computing the central
+ * differences of every plane, if it is not there already. They are computed exactly as
+ * ii_bipoly3 and ii_bipoly5 compute them, so the results of either path are the same.
+ * Returns the slot.
+ *
+ * ring: the row tables
+ * j:    the row
+ */
+
+static inline_macro integer_t
+poly_row_differences(struct poly_ring_t* ring, const integer_t j) {
+  const integer_t slot = j % ring->nrows;
+  const integer_t width = ring->width;
+  const float* row;
+  float *cd2, *cd4;
+  integer_t i, k;
+
+  if (ring->row[slot] == j) return slot;
+
+  for (k = 0; k < ring->nplane; ++k) {
+    row = (const float*)PyArray_GETPTR2(ring->sources[k], j, 0);
+    cd2 = ring->cd2 + ((size_t)k * ring->nrows + slot) * width;
+    for (i = 1; i < width - 1; ++i) {
+      cd2[i] = 1.0f/6.0f * (row[i+1] - 2.0f * row[i] + row[i-1]);
+    }
+
+    if (ring->cd4) {
+      cd4 = ring->cd4 + ((size_t)k * ring->nrows + slot) * width;
+      for (i = 2; i < width - 2; ++i) {
+        cd4[i] = 1.0f/120.0f * (row[i-2] -
+                                4.0f * row[i-1] +
+                                6.0f * row[i] -
+                                4.0f * row[i+1] +
+                                row[i+2]);
+      }
+    }
+  }
+
+  ring->row[slot] = j;
+  return slot;
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Evaluate the polynomial interpolant at a point whose neighbourhood lies inside the input
+ * image, using the row tables. Returns zero without setting the value if the point is too
+ * close to the edge, where the neighbourhood must be reflected.
+ *
+ * poly:  the row tables
+ * data:  the input image
+ * isize: the dimensions of the input image
+ * x:     The fractional x coordinate
+ * y:     The fractional y coordinate
+ * value: The resulting value at x, y after interpolating the data (output)
+ */
+
+static inline_macro int
+interpolate_poly_interior(struct poly_param_t* poly, PyArrayObject* data,
+                          const integer_t isize[2], const float x, const float y,
+                          /* Output parameters */
+                          float* value) {
+  struct poly_ring_t* ring = poly->ring;
+  const integer_t nterms = ring->nterms;
+  const integer_t half = nterms / 2;
+  integer_t nx, ny, cx, cy, j, k, slot;
+  size_t offset;
+  float xval, yval, sx, tx, sy, ty, sx2, tx2, sy2, ty2;
+  float ztemp[6];
+  float cd20y, cd21y, cd40y, cd41y;
+  const float *row, *cd2, *cd4;
+
+  /* Find the cell and offsets the same way as the general path, which
+     shifts the point by half the interpolant before truncating it */
+  nx = (integer_t)x;
+  ny = (integer_t)y;
+  xval = (float)half + (x - (float)nx);
+  yval = (float)half + (y - (float)ny);
+  cx = nx + (integer_t)xval - half;
+  cy = ny + (integer_t)yval - half;
+
+  if (cx - half + 1 < 0 || cx + half >= isize[0] ||
+      cy - half + 1 < 0 || cy + half >= isize[1]) {
+    return 0;
+  }
+
+  if (cx != poly->cx || cy != poly->cy) {
+    for (j = 0; j < nterms; ++j) {
+      k = cy - half + 1 + j;
+      slot = poly_row_differences(ring, k);
+      offset = ((size_t)poly->plane * ring->nrows + slot) * ring->width;
+
+      row = (const float*)PyArray_GETPTR2(data, k, 0);
+      cd2 = ring->cd2 + offset;
+      poly->z0[j] = row[cx];
+      poly->z1[j] = row[cx+1];
+      poly->c20[j] = cd2[cx];
+      poly->c21[j] = cd2[cx+1];
+
+      if (ring->cd4) {
+        cd4 = ring->cd4 + offset;
+        poly->c40[j] = cd4[cx];
+        poly->c41[j] = cd4[cx+1];
+      }
+    }
+
+    poly->cx = cx;
+    poly->cy = cy;
+  }
+
+  sx = xval - (float)(integer_t)xval;
+  tx = 1.0f - sx;
+  sx2 = sx * sx;
+  tx2 = tx * tx;
+  sy = yval - (float)(integer_t)yval;
+  ty = 1.0f - sy;
+  sy2 = sy * sy;
+  ty2 = ty * ty;
+
+  if (nterms == 4) {
+    /* Interpolate in x at each row, then in y, as ii_bipoly3 */
+    for (j = 0; j < 4; ++j) {
+      ztemp[j] = sx * (poly->z1[j] + (sx*sx - 1.0f) * poly->c21[j]) +
+                 tx * (poly->z0[j] + (tx*tx - 1.0f) * poly->c20[j]);
+    }
+
+    cd20y = 1.0f/6.0f * (ztemp[2] - 2.0f * ztemp[1] + ztemp[0]);
+    cd21y = 1.0f/6.0f * (ztemp[3] - 2.0f * ztemp[2] + ztemp[1]);
+
+    *value = sy * (ztemp[2] + (sy * sy - 1.0f) * cd21y) +
+             ty * (ztemp[1] + (ty * ty - 1.0f) * cd20y);
+
+  } else {
+    /* Interpolate in x at each row, then in y, as ii_bipoly5 */
+    for (j = 0; j < 6; ++j) {
+      ztemp[j] = sx * (poly->z1[j] + (sx2 - 1.0f) *
+                       (poly->c21[j] + (sx2 - 4.0f) * poly->c41[j])) +
+        tx * (poly->z0[j] + (tx2 - 1.0f) *
+              (poly->c20[j] + (tx2 - 4.0f) * poly->c40[j]));
+    }
+
+    cd20y = 1.0f/6.0f * (ztemp[3] - 2.0f * ztemp[2] + ztemp[1]);
+    cd21y = 1.0f/6.0f * (ztemp[4] - 2.0f * ztemp[3] + ztemp[2]);
+    cd40y = 1.0f/120.0f * (ztemp[0] -
+                           4.0f * ztemp[1] +
+                           6.0f * ztemp[2] -
+                           4.0f * ztemp[3] +
+                           ztemp[4]);
+    cd41y = 1.0f/120.0f * (ztemp[1] -
+                           4.0f * ztemp[2] +
+                           6.0f * ztemp[3] -
+                           4.0f * ztemp[4] +
+                           ztemp[5]);
+
+    *value = sy * (ztemp[3] + (sy2 - 1.0f) * (cd21y + (sy2 - 4.0f) * cd41y)) +
+      ty * (ztemp[2] + (ty2 - 1.0f) * (cd20y + (ty2 - 4.0f) * cd40y));
+  }
+
+  return 1;
+}
+
 /** --------------------------------------------------------------------------------------------------
  * Perform nearest neighbor interpolation.
  * 
@@ -271,12 +555,19 @@ interpolate_nearest_neighbor(const void* state UNUSED_PARAM,
                              struct driz_error_t* error UNUSED_PARAM) {
 
   integer_t   isize[2];
+  integer_t   nx, ny;
   get_dimensions(data, isize);
 
   assert(state == NULL);
   INTERPOLATION_ASSERTS;
 
-  *value = get_pixel(data, (integer_t)(x + 0.5), (integer_t)(y + 0.5));
+  /* Points in the last half pixel round to the last pixel, not past it */
+  nx = (integer_t)(x + 0.5);
+  ny = (integer_t)(y + 0.5);
+  if (nx >= isize[0]) nx = isize[0] - 1;
+  if (ny >= isize[1]) ny = isize[1] - 1;
+
+  *value = get_pixel(data, nx, ny);
   return 0;
 }
 
@@ -331,13 +622,14 @@ interpolate_bilinear(const void* state UNUSED_PARAM,
     hold12 = get_pixel(data, nx, ny+1);
   }
 
-  if (nx >= isize[0] && ny >= isize[1]) {
+  /* The corner is reflected across whichever edges the cell touches */
+  if (nx >= isize[0] - 1 && ny >= isize[1] - 1) {
     hold22 = 2.0f * hold21 - (2.0f * get_pixel(data, nx, ny-1) -
                               get_pixel(data, nx-1, ny-1));
-  } else if (nx >= isize[0]) {
+  } else if (nx >= isize[0] - 1) {
     hold22 = 2.0f * hold12 - get_pixel(data, nx-1, ny+1);
-  } else if (ny >= isize[1]) {
-    hold22 = 2.0f * hold21 - get_pixel(data, nx+1, ny+1);
+  } else if (ny >= isize[1] - 1) {
+    hold22 = 2.0f * hold21 - get_pixel(data, nx+1, ny-1);
   } else {
     hold22 = get_pixel(data, nx+1, ny+1);
   }
@@ -354,7 +646,7 @@ interpolate_bilinear(const void* state UNUSED_PARAM,
 /** --------------------------------------------------------------------------------------------------
  * Perform cubic polynomial interpolation.
  * 
- * state: A pointer to any constant values specific to this interpolation type. (NULL).
+ * state: A pointer to the row tables (struct poly_param_t), or NULL to always copy a window.
  * data:  A 2D data array 
  * x:     The fractional x coordinate
  * y:     The fractional y coordinate
@@ -363,7 +655,7 @@ interpolate_bilinear(const void* state UNUSED_PARAM,
  */
 
 static int
-interpolate_poly3(const void* state UNUSED_PARAM,
+interpolate_poly3(const void* state,
                   PyArrayObject* data,
                   const float x, const float y,
                   /* Output parameters */
@@ -380,9 +672,14 @@ interpolate_poly3(const void* state UNUSED_PARAM,
   integer_t   isize[2];
   get_dimensions(data, isize);
 
-  assert(state == NULL);
   INTERPOLATION_ASSERTS;;
 
+  /* Away from the edges use the row tables */
+  if (state && interpolate_poly_interior((struct poly_param_t*)state, data, isize,
+                                         x, y, value)) {
+    return 0;
+  }
+
   nx = (integer_t)x;
   ny = (integer_t)y;
 
@@ -468,7 +765,7 @@ interpolate_poly3(const void* state UNUSED_PARAM,
 /** --------------------------------------------------------------------------------------------------
  * Perform quintic polynomial interpolation.
  * 
- * state: A pointer to any constant values specific to this interpolation type. (NULL).
+ * state: A pointer to the row tables (struct poly_param_t), or NULL to always copy a window.
  * data:  A 2D data array 
  * x:     The fractional x coordinate
  * y:     The fractional y coordinate
@@ -477,7 +774,7 @@ interpolate_poly3(const void* state UNUSED_PARAM,
  */
 
 static int
-interpolate_poly5(const void* state UNUSED_PARAM,
+interpolate_poly5(const void* state,
                   PyArrayObject* data,
                   const float x, const float y,
                   /* Output parameters */
@@ -494,9 +791,14 @@ interpolate_poly5(const void* state UNUSED_PARAM,
   integer_t   isize[2];
   get_dimensions(data, isize);
 
-  assert(state == NULL);
   INTERPOLATION_ASSERTS;
 
+  /* Away from the edges use the row tables */
+  if (state && interpolate_poly_interior((struct poly_param_t*)state, data, isize,
+                                         x, y, value)) {
+    return 0;
+  }
+
   nx = (integer_t)x;
   ny = (integer_t)y;
 
@@ -872,7 +1174,149 @@ interp_function* interp_function_map[interp_LAST] = {
 };
 
 /** --------------------------------------------------------------------------------------------------
- * Interpolate grid of pixels onto new grid of different size.
+ * Grow the map of changed tiles on the input image by the distance an interpolation
+ * reads from a point, so a tile is marked if any value interpolated in it may have
+ * changed. Returns the grown map, which the caller must free, or NULL if out of memory.
+ *
+ * p:     structure containing options, input, and output
+ * reach: the distance in pixels the interpolation reads from a point
+ * ntile: the dimensions of the map of tiles (output)
+ */
+
+static unsigned char *
+grow_dirty_tiles(struct driz_param_t* p, const integer_t reach, integer_t ntile[2]) {
+  integer_t i, j, ii, jj, grow;
+  unsigned char *dirty;
+
+  get_dimensions(p->data_dirty, ntile);
+  grow = (reach + DRIZ_TILE_SIZE - 1) / DRIZ_TILE_SIZE;
+
+  dirty = (unsigned char *) calloc(ntile[0] * ntile[1], sizeof(unsigned char));
+  if (dirty == NULL) return NULL;
+
+  for (j = 0; j < ntile[1]; ++j) {
+    for (i = 0; i < ntile[0]; ++i) {
+      if (*(unsigned char *) PyArray_GETPTR2(p->data_dirty, j, i) == 0) continue;
+
+      for (jj = MAX(j - grow, 0); jj <= MIN(j + grow, ntile[1] - 1); ++jj) {
+        for (ii = MAX(i - grow, 0); ii <= MIN(i + grow, ntile[0] - 1); ++ii) {
+          dirty[jj * ntile[0] + ii] = 1;
+        }
+      }
+    }
+  }
+
+  return dirty;
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Blot one row of the output image with nearest neighbor or bilinear interpolation.
+ *
+ * These are the cheapest interpolations, so the cost of calling them through the function
+ * table and looking up each pixel would dominate. Here the interior of the input image is read
+ * directly from its rows and only points in the last row or column, where the bilinear cell
+ * must be reflected, go through interpolate_bilinear. The pixel and weights of each point are
+ * found once and applied to every plane. The results are the same as the general loop in
+ * doblot.
+ *
+ * p:       structure containing options, input, and output
+ * j:       the output row
+ * nplane:  the number of planes blotted
+ * sources: the input image of each plane
+ * outputs: the output image of each plane
+ * isize:   the dimensions of the input image
+ * osize:   the dimensions of the output image
+ * dirty:   the grown map of changed input tiles, or NULL to blot every pixel
+ * ntile:   the dimensions of the dirty tile map
+ * scale2:  the square of the pixel scale ratio
+ */
+
+static int
+blot_row_simple(struct driz_param_t* p, const integer_t j, const integer_t nplane,
+                PyArrayObject** sources, PyArrayObject** outputs,
+                const integer_t isize[2], const integer_t osize[2],
+                const unsigned char* dirty, const integer_t ntile[2], const float scale2) {
+  const npy_intp stride = PyArray_STRIDE(sources[0], 0) / sizeof(float);
+  const double* map = get_pixmap(p->pixmap, 0, j);
+  const float* pix;
+  float xo, yo, sx, tx, sy, ty, v;
+  float w00, w10, w01, w11;
+  integer_t i, k, nx, ny;
+
+  for (i = 0; i < osize[0]; ++i) {
+    xo = map[2*i];
+    yo = map[2*i+1];
+
+    if (npy_isnan(xo) || npy_isnan(yo)) {
+      driz_error_format_message(p->error, "NaN in pixmap[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
+      return 1;
+    }
+
+    if (! (xo >= 0.0 && xo < isize[0] && yo >= 0.0 && yo < isize[1])) {
+      for (k = 0; k < nplane; ++k) {
+        set_pixel(outputs[k], i, j, p->misval);
+      }
+      p->nmiss++;
+      continue;
+    }
+
+    if (dirty && ! dirty[((integer_t) yo / DRIZ_TILE_SIZE) * ntile[0] +
+                         (integer_t) xo / DRIZ_TILE_SIZE]) {
+      continue;
+    }
+
+    if (p->interpolation == interp_nearest) {
+      nx = (integer_t)(xo + 0.5);
+      ny = (integer_t)(yo + 0.5);
+      if (nx >= isize[0]) nx = isize[0] - 1;
+      if (ny >= isize[1]) ny = isize[1] - 1;
+
+      for (k = 0; k < nplane; ++k) {
+        v = get_pixel(sources[k], nx, ny);
+        set_pixel(outputs[k], i, j, v * p->ef / scale2);
+      }
+
+      continue;
+    }
+
+    nx = (integer_t)xo;
+    ny = (integer_t)yo;
+
+    if (nx < isize[0] - 1 && ny < isize[1] - 1) {
+      sx = xo - (float)nx;
+      tx = 1.0f - sx;
+      sy = yo - (float)ny;
+      ty = 1.0f - sy;
+
+      w00 = tx * ty;
+      w10 = sx * ty;
+      w01 = sy * tx;
+      w11 = sx * sy;
+
+      for (k = 0; k < nplane; ++k) {
+        pix = (const float*)PyArray_GETPTR2(sources[k], ny, nx);
+        v = w00 * pix[0] + w10 * pix[1] + w01 * pix[stride] + w11 * pix[stride+1];
+        set_pixel(outputs[k], i, j, v * p->ef / scale2);
+      }
+
+    } else {
+      for (k = 0; k < nplane; ++k) {
+        if (interpolate_bilinear(NULL, sources[k], xo, yo, &v, p->error)) {
+          return 1;
+        }
+        set_pixel(outputs[k], i, j, v * p->ef / scale2);
+      }
+    }
+  }
+
+  return 0;
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Interpolate grid of pixels onto new grid of different size. If a map of the changed
+ * tiles on the input image is supplied, only the output pixels that depend on them are
+ * recomputed and the rest are left as they are. If the parameters hold several planes,
+ * each is blotted through the pixmap, which is read and checked once for all of them.
  *
  * p:   structure containing options, input, and output
  */
@@ -884,16 +1328,35 @@ doblot(struct driz_param_t* p) {
   const float space = 0.01;
   integer_t isize[2], osize[2];
   float scale2, xo, yo, v;
-  integer_t i, j;
+  integer_t i, j, k, nplane;
   interp_function* interpolate;
   struct sinc_param_t sinc;
   struct lanczos_param_t lanczos;
+  struct poly_param_t* poly = NULL;
+  struct poly_ring_t ring = {0};
+  integer_t nterms;
+  PyArrayObject **sources, **outputs;
   void* state = NULL;
+  unsigned char *dirty = NULL;
+  integer_t reach, ntile[2] = {0, 0};
   
   driz_log_message("starting doblot");
   get_dimensions(p->data, isize);
   get_dimensions(p->output_data, osize);
 
+  /* A single plane is the data and output images themselves */
+  if (p->data_planes && p->output_planes) {
+    nplane = p->nplane;
+    sources = p->data_planes;
+    outputs = p->output_planes;
+  } else {
+    nplane = 1;
+    sources = &p->data;
+    outputs = &p->output_data;
+  }
+
+  lanczos.lut = NULL;
+
   /* Select interpolation function */
   assert(p->interpolation >= 0 && p->interpolation < interp_LAST);
   interpolate = interp_function_map[p->interpolation];
@@ -902,8 +1365,6 @@ doblot(struct driz_param_t* p) {
     goto doblot_exit_;
   }
 
-  lanczos.lut = NULL;
-
   /* Some interpolation functions need some pre-calculated state */
   if (p->interpolation == interp_lanczos3 || p->interpolation == interp_lanczos5) {
 
@@ -925,9 +1386,54 @@ doblot(struct driz_param_t* p) {
   } else if (p->interpolation == interp_sinc || p->interpolation == interp_lsinc) {
     sinc.sinscl = p->sinscl;
     state = &sinc;
+
+  } else if (p->interpolation == interp_poly3 || p->interpolation == interp_poly5) {
+    /* The planes share one ring of rows, each keeps its own last cell */
+    nterms = p->interpolation == interp_poly3 ? 4 : 6;
+    if (init_poly_ring(&ring, nterms, poly_ring_rows(p, nterms, isize, osize),
+                       nplane, sources, isize) ||
+        (poly = (struct poly_param_t*)calloc(nplane, sizeof(struct poly_param_t))) == NULL) {
+      driz_error_set_message(p->error, "Out of memory");
+      goto doblot_exit_;
+    }
+
+    for (k = 0; k < nplane; ++k) {
+      poly[k].ring = &ring;
+      poly[k].plane = k;
+      poly[k].cx = poly[k].cy = -1;
+    }
     
   } /* Otherwise state is NULL */
 
+  /* Distance from a point the interpolation reads pixels, for growing
+     the changed tiles */
+  if (p->data_dirty) {
+    switch (p->interpolation) {
+    case interp_nearest:
+    case interp_bilinear:
+      reach = 1;
+      break;
+    case interp_poly3:
+      reach = 2;
+      break;
+    case interp_poly5:
+      reach = 3;
+      break;
+    case interp_lanczos3:
+    case interp_lanczos5:
+      reach = lanczos.nbox + 1;
+      break;
+    default:
+      reach = INTERPOLATE_SINC_NCONV;
+      break;
+    }
+
+    if ((dirty = grow_dirty_tiles(p, reach, ntile)) == NULL) {
+      driz_error_set_message(p->error, "Out of memory");
+      goto doblot_exit_;
+    }
+  }
+
   /* In the WCS case, we can't use the scale to calculate the Jacobian,
      so we need to do it.
 
@@ -946,19 +1452,28 @@ doblot(struct driz_param_t* p) {
   
   for (j = 0; j < osize[1]; ++j) {
 
+    /* The simple interpolations have their own loop */
+    if (p->interpolation == interp_nearest || p->interpolation == interp_bilinear) {
+      if (blot_row_simple(p, j, nplane, sources, outputs, isize, osize,
+                          dirty, ntile, scale2)) {
+        goto doblot_exit_;
+      }
+      continue;
+    }
+
     /* Loop through the output positions and do the interpolation */
     for (i = 0; i < osize[0]; ++i) {
       if (oob_pixel(p->pixmap, i, j)) {
-          driz_error_format_message(p->error, "OOB in pixmap[%d,%d]", i, j);
-          return 1;
+          driz_error_format_message(p->error, "OOB in pixmap[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
+          goto doblot_exit_;
       } else {
         xo = get_pixmap(p->pixmap, i, j)[0];
         yo = get_pixmap(p->pixmap, i, j)[1];
       }
       
       if (npy_isnan(xo) || npy_isnan(yo)) {
-          driz_error_format_message(p->error, "NaN in pixmap[%d,%d]", i, j);
-          return 1;
+          driz_error_format_message(p->error, "NaN in pixmap[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
+          goto doblot_exit_;
       }
       
       /* Check it is on the input image */
@@ -967,29 +1482,39 @@ doblot(struct driz_param_t* p) {
 
         double value;
 
-        /* Check for look-up-table interpolation */
-        if (interpolate(state, p->data, xo, yo, &v, p->error)) {
-          goto doblot_exit_;
+        /* Skip pixels whose inputs have not changed */
+        if (dirty && ! dirty[((integer_t) yo / DRIZ_TILE_SIZE) * ntile[0] +
+                             (integer_t) xo / DRIZ_TILE_SIZE]) {
+          continue;
         }
+
+        for (k = 0; k < nplane; ++k) {
+          /* Check for look-up-table interpolation */
+          if (interpolate(poly ? &poly[k] : state, sources[k], xo, yo, &v, p->error)) {
+            goto doblot_exit_;
+          }
         
-        value = v * p->ef / scale2;
-        if (oob_pixel(p->output_data, i, j)) {
-          driz_error_format_message(p->error, "OOB in output_data[%d,%d]", i, j);
-          return 1;
-        } else {
-          set_pixel(p->output_data, i, j, value);
+          value = v * p->ef / scale2;
+          if (oob_pixel(outputs[k], i, j)) {
+            driz_error_format_message(p->error, "OOB in output_data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
+            goto doblot_exit_;
+          } else {
+            set_pixel(outputs[k], i, j, value);
+          }
         }
 
       } else {
         /* If there is nothing for us then set the output to missing C
            value flag */
-        if (oob_pixel(p->output_data, i, j)) {
-          driz_error_format_message(p->error, "OOB in output_data[%d,%d]", i, j);
-          return 1;
-        } else {
-          set_pixel(p->output_data, i, j, p->misval);
-          p->nmiss++;
+        for (k = 0; k < nplane; ++k) {
+          if (oob_pixel(outputs[k], i, j)) {
+            driz_error_format_message(p->error, "OOB in output_data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
+            goto doblot_exit_;
+          } else {
+            set_pixel(outputs[k], i, j, p->misval);
+          }
         }
+        p->nmiss++;
       }
     }
   }
@@ -997,6 +1522,9 @@ doblot(struct driz_param_t* p) {
  doblot_exit_:
   driz_log_message("ending doblot");
   if (lanczos.lut) free(lanczos.lut);
+  if (poly) free(poly);
+  free_poly_ring(&ring);
+  if (dirty) free(dirty);
 
   return driz_error_is_set(p->error);
 }
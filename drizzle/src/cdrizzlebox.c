@@ -11,6 +11,9 @@
 #include <math.h>
 #include <stdlib.h>
 
+/* Number of input pixels on a line covered by one affine fit of the pixel map */
+#define AFFINE_TILE 16
+
 /** --------------------------------------------------------------------------------------------------
  * Update the flux and counts in the output image using a weighted average
  *
@@ -28,10 +31,21 @@ update_data(struct driz_param_t* p, const integer_t ii, const integer_t jj,
 
   const double vc_plus_dow = vc + dow;
   
+  /* The weighted sum needs no division, it is normalized once when the
+     output is read */
+  if (p->sum_data) {
+    if (oob_pixel(p->output_data, ii, jj)) {
+      driz_error_format_message(p->error, "OOB in output_data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
+      return 1;
+    } else if (dow != 0.0) {
+      float *pixel = (float*) PyArray_GETPTR2(p->output_data, jj, ii);
+      *pixel += dow * d;
+    }
+
   /* Just a simple calculation without logical tests */
-  if (vc == 0.0) {
+  } else if (vc == 0.0) {
     if (oob_pixel(p->output_data, ii, jj)) {
-      driz_error_format_message(p->error, "OOB in output_data[%d,%d]", ii, jj);
+      driz_error_format_message(p->error, "OOB in output_data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
       return 1;
     } else {
       set_pixel(p->output_data, ii, jj, d);
@@ -39,7 +53,7 @@ update_data(struct driz_param_t* p, const integer_t ii, const integer_t jj,
 
   } else if (vc_plus_dow != 0.0) {
     if (oob_pixel(p->output_data, ii, jj)) {
-      driz_error_format_message(p->error, "OOB in output_data[%d,%d]", ii, jj);
+      driz_error_format_message(p->error, "OOB in output_data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
       return 1;
     } else {
       double value;
@@ -49,12 +63,16 @@ update_data(struct driz_param_t* p, const integer_t ii, const integer_t jj,
   }
 
   if (oob_pixel(p->output_counts, ii, jj)) {
-    driz_error_format_message(p->error, "OOB in output_counts[%d,%d]", ii, jj);
+    driz_error_format_message(p->error, "OOB in output_counts[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
     return 1;
   } else {
     set_pixel(p->output_counts, ii, jj, vc_plus_dow);
   }
 
+  if (p->output_dirty) {
+    set_dirty(p->output_dirty, ii, jj);
+  }
+
   return 0;
 }
 
@@ -67,11 +85,11 @@ update_data(struct driz_param_t* p, const integer_t ii, const integer_t jj,
 integer_t
 compute_bit_value(integer_t uuid) {
   integer_t bv;
-  int np, bit_no;
+  integer_t np, bit_no;
   
   np = (uuid - 1) / 32 + 1;
   bit_no = (uuid - 1 - (32 * (np - 1)));
-  bv = (integer_t)(1 << bit_no);
+  bv = (integer_t)((npy_uint32)1 << bit_no);
 
   return bv;
 }
@@ -234,6 +252,60 @@ over(const integer_t i, const integer_t j,
   return 0.0;
 }
 
+/** --------------------------------------------------------------------------------------------------
+ * Calculate overlap between an interval and a pixel along one axis. The product of the
+ * overlaps along each axis is the overlap of an axis aligned rectangle with the pixel.
+ *
+ * i:    the coordinate of a pixel on the output image
+ * xmin: the lower edge of the interval
+ * xmax: the upper edge of the interval
+ */
+
+static inline_macro double
+over_interval(const integer_t i, const double xmin, const double xmax) {
+  double dx;
+
+  dx = MIN(xmax, (double)(i) + 0.5) - MAX(xmin, (double)(i) - 0.5);
+
+  if (dx > 0.0)
+    return dx;
+
+  return 0.0;
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Check if a quadrilateral is a rectangle whose sides are aligned with the axes.
+ * The points are in cyclical order, starting with either a horizontal or vertical side.
+ *
+ * x: the x coordinates of the corners
+ * y: the y coordinates of the corners
+ */
+
+static inline_macro int
+is_axis_aligned(const double x[4], const double y[4]) {
+  return (y[0] == y[1] && x[1] == x[2] && y[2] == y[3] && x[3] == x[0]) ||
+         (x[0] == x[1] && y[1] == y[2] && x[2] == x[3] && y[3] == y[0]);
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * The factor applied to each input pixel as it is read: the square of the
+ * scale, divided by the exposure time when the input is in counts. The
+ * input image itself is never rescaled.
+ *
+ * p: structure containing options, input, and output
+ */
+
+static inline_macro double
+get_data_scale(struct driz_param_t* p) {
+  double scale2 = p->scale * p->scale;
+
+  if (p->in_units == unit_counts) {
+    scale2 /= p->exposure_time;
+  }
+
+  return scale2;
+}
+
 /** --------------------------------------------------------------------------------------------------
  * The kernel assumes all the flux in an input pixel is at the center 
  *
@@ -244,11 +316,11 @@ static int
 do_kernel_point(struct driz_param_t* p) {
   integer_t i, j, ii, jj;
   integer_t xbounds[2], ybounds[2], osize[2];
-  float scale2, vc, d, dow;
+  float dscale, vc, d, dow;
   integer_t bv;
   int margin;
 
-  scale2 = p->scale * p->scale;
+  dscale = get_data_scale(p);
   bv = compute_bit_value(p->uuid);
   
   margin = 2;
@@ -284,7 +356,7 @@ do_kernel_point(struct driz_param_t* p) {
 
         } else {  
           if (oob_pixel(p->output_counts, ii, jj)) {
-            driz_error_format_message(p->error, "OOB in output_counts[%d,%d]", ii, jj);
+            driz_error_format_message(p->error, "OOB in output_counts[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
             return 1;
           } else {
             vc = get_pixel(p->output_counts, ii, jj);
@@ -292,25 +364,15 @@ do_kernel_point(struct driz_param_t* p) {
 
           /* Allow for stretching because of scale change */
           if (oob_pixel(p->data, i, j)) {
-            driz_error_format_message(p->error, "OOB in data[%d,%d]", i, j);
+            driz_error_format_message(p->error, "OOB in data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
             return 1;
           } else {
-            d = get_pixel(p->data, i, j) * scale2;
+            d = get_pixel(p->data, i, j) * dscale;
           }
         
           /* Scale the weighting mask by the scale factor.  Note that we
              DON'T scale by the Jacobian as it hasn't been calculated */
-          if (p->weights) {
-            if (oob_pixel(p->weights, i, j)) {
-              driz_error_format_message(p->error, "OOB in weights[%d,%d]", i, j);
-              return 1;
-            } else {
-              dow = get_pixel(p->weights, i, j) * p->weight_scale;
-            }
-    
-          } else {
-            dow = 1.0;
-          }
+          dow = get_weight(p, i, j);
   
           /* If we are creating of modifying the context image,
              we do so here. */
@@ -329,6 +391,59 @@ do_kernel_point(struct driz_param_t* p) {
   return 0;
 }
 
+/** --------------------------------------------------------------------------------------------------
+ * Find the span of output pixels on a line whose centers lie inside the tophat disk. The span
+ * is estimated from the chord of the circle and its ends are then checked with the same radial
+ * test the kernel used per pixel, so the same pixels are selected. Returns zero if the span is empty.
+ *
+ * xout: the x coordinate of the center of the disk on the output image
+ * ddy:  the distance from the center of the disk to the line
+ * pfo2: the square of the radius of the disk
+ * nxi:  the first pixel on the line that could be inside the disk
+ * nxa:  the last pixel on the line that could be inside the disk
+ * span: the first and last pixel inside the disk (output)
+ */
+
+static inline_macro int
+tophat_span(const double xout, const double ddy, const double pfo2,
+            const integer_t nxi, const integer_t nxa, integer_t span[2]) {
+  double chord, ddx;
+
+  chord = pfo2 - ddy * ddy;
+  if (chord < 0.0) return 0;
+  chord = sqrt(chord);
+
+  span[0] = MAX((integer_t) ceil(xout - chord), nxi);
+  span[1] = MIN((integer_t) floor(xout + chord), nxa);
+
+  /* Nudge the ends so they agree with the radial test */
+  while (span[0] <= span[1]) {
+    ddx = xout - (double) span[0];
+    if (ddx*ddx + ddy*ddy <= pfo2) break;
+    ++ span[0];
+  }
+
+  while (span[0] > nxi) {
+    ddx = xout - (double) (span[0] - 1);
+    if (ddx*ddx + ddy*ddy > pfo2) break;
+    -- span[0];
+  }
+
+  while (span[1] >= span[0]) {
+    ddx = xout - (double) span[1];
+    if (ddx*ddx + ddy*ddy <= pfo2) break;
+    -- span[1];
+  }
+
+  while (span[1] < nxa) {
+    ddx = xout - (double) (span[1] + 1);
+    if (ddx*ddx + ddy*ddy > pfo2) break;
+    ++ span[1];
+  }
+
+  return span[0] <= span[1];
+}
+
 /** --------------------------------------------------------------------------------------------------
  * This kernel assumes flux is distrubuted evenly across a circle around the center of a pixel
  * 
@@ -338,12 +453,12 @@ do_kernel_point(struct driz_param_t* p) {
 static int
 do_kernel_tophat(struct driz_param_t* p) {
   integer_t bv, i, j, ii, jj, nhit, nxi, nxa, nyi, nya;
-  integer_t xbounds[2], ybounds[2], osize[2];
-  float scale2, pfo, pfo2, vc, d, dow;
-  double xxi, xxa, yyi, yya, ddx, ddy, r2;
+  integer_t xbounds[2], ybounds[2], osize[2], span[2];
+  float dscale, pfo, pfo2, vc, d, dow;
+  double xxi, xxa, yyi, yya, ddy;
   int margin;
   
-  scale2 = p->scale * p->scale;
+  dscale = get_data_scale(p);
   pfo = p->pixel_fraction / p->scale / 2.0;
   pfo2 = pfo * pfo;
   bv = compute_bit_value(p->uuid);
@@ -387,58 +502,43 @@ do_kernel_tophat(struct driz_param_t* p) {
   
         /* Allow for stretching because of scale change */
         if (oob_pixel(p->data, i, j)) {
-          driz_error_format_message(p->error, "OOB in data[%d,%d]", i, j);
+          driz_error_format_message(p->error, "OOB in data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
           return 1;
         } else {
-          d = get_pixel(p->data, i, j) * scale2;
+          d = get_pixel(p->data, i, j) * dscale;
         }
 
         /* Scale the weighting mask by the scale factor and inversely by
            the Jacobian to ensure conservation of weight in the output */
-        if (p->weights) {
-          if (oob_pixel(p->weights, i, j)) {
-            driz_error_format_message(p->error, "OOB in weights[%d,%d]", i, j);
-            return 1;
-          } else {
-            dow = get_pixel(p->weights, i, j) * p->weight_scale;
-          }
-        
-        } else {
-          dow = 1.0;
-        }
+        dow = get_weight(p, i, j);
   
         /* Loop over output pixels which could be affected */
         for (jj = nyi; jj <= nya; ++jj) {
           ddy = xyout[1]- (double)jj;
   
-          /* Check it is on the output image */
-          for (ii = nxi; ii <= nxa; ++ii) {
-            ddx = xyout[0] - (double)ii;
-  
-            /* Radial distance */
-            r2 = ddx*ddx + ddy*ddy;
-  
-            /* Weight is one within the specified radius and zero outside.
-               Note: weight isn't conserved in this case */
-            if (r2 <= pfo2) {
-              /* Count the hits */
-              nhit++;
-              if (oob_pixel(p->output_counts, ii, jj)) {
-                driz_error_format_message(p->error, "OOB in output_counts[%d,%d]", ii, jj);
-                return 1;
-              } else {
-                vc = get_pixel(p->output_counts, ii, jj);
-              }
+          /* Weight is one within the specified radius and zero outside,
+             so only the pixels on the chord of the disk are visited.
+             Note: weight isn't conserved in this case */
+          if (! tophat_span(xyout[0], ddy, pfo2, nxi, nxa, span)) continue;
+
+          for (ii = span[0]; ii <= span[1]; ++ii) {
+            /* Count the hits */
+            nhit++;
+            if (oob_pixel(p->output_counts, ii, jj)) {
+              driz_error_format_message(p->error, "OOB in output_counts[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
+              return 1;
+            } else {
+              vc = get_pixel(p->output_counts, ii, jj);
+            }
   
-              /* If we are create or modifying the context image,
-                 we do so here. */
-              if (p->output_context && dow > 0.0) {
-                set_bit(p->output_context, ii, jj, bv);
-              }
+            /* If we are create or modifying the context image,
+               we do so here. */
+            if (p->output_context && dow > 0.0) {
+              set_bit(p->output_context, ii, jj, bv);
+            }
   
-              if (update_data(p, ii, jj, d, vc, dow)) {
-                return 1;
-              }
+            if (update_data(p, ii, jj, d, vc, dow)) {
+              return 1;
             }
           }
         }
@@ -464,7 +564,7 @@ do_kernel_gaussian(struct driz_param_t* p) {
   integer_t xbounds[2], ybounds[2], osize[2];
   float vc, d, dow;
   double gaussian_efac, gaussian_es;
-  double pfo, ac,  scale2, xxi, xxa, yyi, yya, w, ddx, ddy, r2, dover;
+  double pfo, ac,  scale2, dscale, xxi, xxa, yyi, yya, w, ddx, ddy, r2, dover;
   const double nsig = 2.5;
   int margin;
   
@@ -477,6 +577,7 @@ do_kernel_gaussian(struct driz_param_t* p) {
   
   ac = 1.0 / (p->pixel_fraction * p->pixel_fraction);
   scale2 = p->scale * p->scale;
+  dscale = get_data_scale(p);
   bv = compute_bit_value(p->uuid);
   
   gaussian_efac = (2.3548*2.3548) * scale2 * ac / 2.0;
@@ -521,25 +622,15 @@ do_kernel_gaussian(struct driz_param_t* p) {
   
         /* Allow for stretching because of scale change */
         if (oob_pixel(p->data, i, j)) {
-          driz_error_format_message(p->error, "OOB in data[%d,%d]", i, j);
+          driz_error_format_message(p->error, "OOB in data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
           return 1;
         } else {
-          d = get_pixel(p->data, i, j) * scale2;
+          d = get_pixel(p->data, i, j) * dscale;
         }
 
       /* Scale the weighting mask by the scale factor and inversely by
          the Jacobian to ensure conservation of weight in the output */
-      if (p->weights) {
-        if (oob_pixel(p->weights, i, j)) {
-          driz_error_format_message(p->error, "OOB in weights[%d,%d]", i, j);
-          return 1;
-        } else {
-          w = get_pixel(p->weights, i, j) * p->weight_scale;
-        }
-
-        } else {
-          w = 1.0;
-        }
+      w = get_weight(p, i, j);
   
         /* Loop over output pixels which could be affected */
         for (jj = nyi; jj <= nya; ++jj) {
@@ -557,7 +648,7 @@ do_kernel_gaussian(struct driz_param_t* p) {
             ++nhit;
   
             if (oob_pixel(p->output_counts, ii, jj)) {
-              driz_error_format_message(p->error, "OOB in output_counts[%d,%d]", ii, jj);
+              driz_error_format_message(p->error, "OOB in output_counts[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
               return 1;
             } else {
               vc = get_pixel(p->output_counts, ii, jj);
@@ -596,7 +687,7 @@ static int
 do_kernel_lanczos(struct driz_param_t* p) {
   integer_t bv, i, j, ii, jj, nxi, nxa, nyi, nya, nhit, ix, iy;
   integer_t xbounds[2], ybounds[2], osize[2];
-  float scale2, vc, d, dow;
+  float dscale, vc, d, dow;
   double pfo, xx, yy, xxi, xxa, yyi, yya, w, dx, dy, dover;
   int kernel_order;
   int margin;
@@ -607,7 +698,7 @@ do_kernel_lanczos(struct driz_param_t* p) {
   dx = 1.0;
   dy = 1.0;
 
-  scale2 = p->scale * p->scale;
+  dscale = get_data_scale(p);
   kernel_order = (p->kernel == kernel_lanczos2) ? 2 : 3;
   pfo = (double)kernel_order * p->pixel_fraction / p->scale;
   bv = compute_bit_value(p->uuid);
@@ -664,25 +755,15 @@ do_kernel_lanczos(struct driz_param_t* p) {
   
         /* Allow for stretching because of scale change */
         if (oob_pixel(p->data, i, j)) {
-          driz_error_format_message(p->error, "OOB in data[%d,%d]", i, j);
+          driz_error_format_message(p->error, "OOB in data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
           return 1;
         } else {
-          d = get_pixel(p->data, i, j) * scale2;
+          d = get_pixel(p->data, i, j) * dscale;
         }
 
         /* Scale the weighting mask by the scale factor and inversely by
            the Jacobian to ensure conservation of weight in the output */
-        if (p->weights) {
-          if (oob_pixel(p->weights, i, j)) {
-            driz_error_format_message(p->error, "OOB in weights[%d,%d]", i, j);
-            return 1;
-          } else {
-            w = get_pixel(p->weights, i, j) * p->weight_scale;
-          }
-
-        } else {
-          w = 1.0;
-        }
+        w = get_weight(p, i, j);
   
         /* Loop over output pixels which could be affected */
         for (jj = nyi; jj <= nya; ++jj) {
@@ -698,7 +779,7 @@ do_kernel_lanczos(struct driz_param_t* p) {
             ++nhit;
   
             if (oob_pixel(p->output_counts, ii, jj)) {
-              driz_error_format_message(p->error, "OOB in output_counts[%d,%d]", ii, jj);
+              driz_error_format_message(p->error, "OOB in output_counts[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
               return 1;
             } else {
               vc = get_pixel(p->output_counts, ii, jj);
@@ -741,7 +822,7 @@ do_kernel_turbo(struct driz_param_t* p) {
   integer_t bv, i, j, ii, jj, nxi, nxa, nyi, nya, nhit, iis, iie, jjs, jje;
   integer_t xbounds[2], ybounds[2], osize[2];
   float vc, d, dow;
-  double pfo, scale2, ac;
+  double pfo, scale2, dscale, ac;
   double xxi, xxa, yyi, yya, w, dover;
   int margin;
     
@@ -750,6 +831,7 @@ do_kernel_turbo(struct driz_param_t* p) {
   ac = 1.0 / (p->pixel_fraction * p->pixel_fraction);
   pfo = p->pixel_fraction / p->scale / 2.0;
   scale2 = p->scale * p->scale;
+  dscale = get_data_scale(p);
   
   margin = 2;
   if (check_image_overlap(p, margin, ybounds)) return 1;
@@ -794,25 +876,15 @@ do_kernel_turbo(struct driz_param_t* p) {
   
         /* Allow for stretching because of scale change */
         if (oob_pixel(p->data, i, j)) {
-          driz_error_format_message(p->error, "OOB in data[%d,%d]", i, j);
+          driz_error_format_message(p->error, "OOB in data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
           return 1;
         } else {
-          d = get_pixel(p->data, i, j) * (float)scale2;
+          d = get_pixel(p->data, i, j) * (float)dscale;
         }
 
         /* Scale the weighting mask by the scale factor and inversely by
            the Jacobian to ensure conservation of weight in the output. */
-        if (p->weights) {
-          if (oob_pixel(p->weights, i, j)) {
-            driz_error_format_message(p->error, "OOB in weights[%d,%d]", i, j);
-            return 1;
-          } else {
-            w = get_pixel(p->weights, i, j) * p->weight_scale;
-          }
-
-        } else {
-          w = 1.0;
-        }
+        w = get_weight(p, i, j);
 
         /* Loop over the output pixels which could be affected */
         for (jj = jjs; jj <= jje; ++jj) {
@@ -829,7 +901,7 @@ do_kernel_turbo(struct driz_param_t* p) {
               ++nhit;
   
               if (oob_pixel(p->output_counts, ii, jj)) {
-                driz_error_format_message(p->error, "OOB in output_counts[%d,%d]", ii, jj);
+                driz_error_format_message(p->error, "OOB in output_counts[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
                 return 1;
               } else {
                 vc = get_pixel(p->output_counts, ii, jj);
@@ -870,16 +942,19 @@ do_kernel_turbo(struct driz_param_t* p) {
 int
 do_kernel_square(struct driz_param_t* p) {
   integer_t bv, i, j, ii, jj, min_ii, max_ii, min_jj, max_jj, nhit;
-  integer_t xbounds[2], ybounds[2], osize[2];
-  float scale2, vc, d, dow;
-  double dh, jaco, tem, dover, w;
+  integer_t itile, iend, xbounds[2], ybounds[2], osize[2];
+  float dscale, vc, d, dow;
+  double dh, jaco = 0.0, tem, dover, w, oy = 0.0;
   double xyin[4][2], xyout[2], xout[4], yout[4];
-  int margin;
+  double xbase = 0.0, ybase = 0.0, xcorner[4], ycorner[4];
+  double xmin, xmax, ymin, ymax;
+  struct affine_map fit;
+  int margin, use_fit, rect_fit = 0, rect;
   
   driz_log_message("starting do_kernel_square");  
   dh = 0.5 * p->pixel_fraction;
   bv = compute_bit_value(p->uuid);
-  scale2 = p->scale * p->scale;
+  dscale = get_data_scale(p);
   
   /* Next the "classic" drizzle square kernel...  this is different
      because we have to transform all four corners of the shrunken
@@ -910,105 +985,174 @@ do_kernel_square(struct driz_param_t* p) {
     xyin[2][1] = (double) j - dh;
     xyin[3][1] = (double) j - dh;
   
-    for (i = xbounds[0]; i < xbounds[1]; ++i) {
-      nhit = 0;
+    /* The line is split into tiles. Where the pixel map is close enough
+       to affine over a tile, the corners are generated from the fit */
 
-      xyin[0][0] = (double) i - dh;
-      xyin[1][0] = (double) i + dh;
-      xyin[2][0] = (double) i + dh;
-      xyin[3][0] = (double) i - dh;
-  
-      for (ii = 0; ii < 4; ++ii) {
-        if (map_point(p->pixmap, xyin[ii], xyout)) {
-            goto _miss;
+    for (itile = xbounds[0]; itile < xbounds[1]; itile = iend) {
+      iend = MIN(itile + AFFINE_TILE, xbounds[1]);
+
+      use_fit = p->affine_tolerance >= 0.0 && dh > 0.0 && dh < 1.0 &&
+                ! fit_affine_map(p->pixmap, itile, iend, j,
+                                 p->affine_tolerance, &fit);
+
+      if (use_fit) {
+        /* Corner offsets from the pixel center. They follow map_point,
+           which interpolates x along the line below the point and y along
+           the column to the left of it */
+
+        xcorner[0] = - dh * fit.slope[0][0];
+        xcorner[1] = dh * fit.slope[0][0];
+        xcorner[2] = dh * fit.slope[0][0] - fit.slope[0][1];
+        xcorner[3] = - dh * fit.slope[0][0] - fit.slope[0][1];
+
+        ycorner[0] = dh * fit.slope[1][1] - fit.slope[1][0];
+        ycorner[1] = dh * fit.slope[1][1];
+        ycorner[2] = - dh * fit.slope[1][1];
+        ycorner[3] = - dh * fit.slope[1][1] - fit.slope[1][0];
+
+        /* The corners only move by a constant step along the tile,
+           so the Jacobian and orientation are the same for every pixel */
+
+        jaco = 0.5f * ((xcorner[1] - xcorner[3]) * (ycorner[0] - ycorner[2]) -
+                       (xcorner[0] - xcorner[2]) * (ycorner[1] - ycorner[3]));
+
+        if (jaco < 0.0) {
+          jaco *= -1.0;
+          /* Swap */
+          tem = xcorner[1]; xcorner[1] = xcorner[3]; xcorner[3] = tem;
+          tem = ycorner[1]; ycorner[1] = ycorner[3]; ycorner[3] = tem;
         }
-        xout[ii] = xyout[0];
-        yout[ii] = xyout[1];
-      }
-  
-      /* Work out the area of the quadrilateral on the output grid.
-         Note that this expression expects the points to be in clockwise
-         order */
-      
-      jaco = 0.5f * ((xout[1] - xout[3]) * (yout[0] - yout[2]) -
-                     (xout[0] - xout[2]) * (yout[1] - yout[3]));
-  
-      if (jaco < 0.0) {
-        jaco *= -1.0;
-        /* Swap */
-        tem = xout[1]; xout[1] = xout[3]; xout[3] = tem;
-        tem = yout[1]; yout[1] = yout[3]; yout[3] = tem;
+
+        xbase = fit.offset[0];
+        ybase = fit.offset[1];
+
+        /* Without rotation or shear the corners form a rectangle aligned
+           with the axes, whose overlap with the output pixels is separable */
+
+        rect_fit = fabs(fit.slope[0][1]) <= p->affine_tolerance &&
+                   fabs(fit.slope[1][0]) <= p->affine_tolerance;
       }
+
+      for (i = itile; i < iend; ++i) {
+        nhit = 0;
+
+        if (use_fit) {
+          for (ii = 0; ii < 4; ++ii) {
+            xout[ii] = xbase + xcorner[ii];
+            yout[ii] = ybase + ycorner[ii];
+          }
+
+          xbase += fit.slope[0][0];
+          ybase += fit.slope[1][0];
+          rect = rect_fit;
+
+        } else {
+          xyin[0][0] = (double) i - dh;
+          xyin[1][0] = (double) i + dh;
+          xyin[2][0] = (double) i + dh;
+          xyin[3][0] = (double) i - dh;
+
+          for (ii = 0; ii < 4; ++ii) {
+            if (map_point(p->pixmap, xyin[ii], xyout)) {
+                goto _miss;
+            }
+            xout[ii] = xyout[0];
+            yout[ii] = xyout[1];
+          }
+
+          /* Work out the area of the quadrilateral on the output grid.
+             Note that this expression expects the points to be in clockwise
+             order */
+
+          jaco = 0.5f * ((xout[1] - xout[3]) * (yout[0] - yout[2]) -
+                         (xout[0] - xout[2]) * (yout[1] - yout[3]));
+
+          if (jaco < 0.0) {
+            jaco *= -1.0;
+            /* Swap */
+            tem = xout[1]; xout[1] = xout[3]; xout[3] = tem;
+            tem = yout[1]; yout[1] = yout[3]; yout[3] = tem;
+          }
+
+          rect = is_axis_aligned(xout, yout);
+        }
     
-      /* Allow for stretching because of scale change */
-      if (oob_pixel(p->data, i, j)) {
-        driz_error_format_message(p->error, "OOB in data[%d,%d]", i, j);
-        return 1;
-      } else {
-        d = get_pixel(p->data, i, j) * scale2;
-      }
-      
-      /* Scale the weighting mask by the scale factor and inversely by
-         the Jacobian to ensure conservation of weight in the output */
-      if (p->weights) {
-        if (oob_pixel(p->weights, i, j)) {
-          driz_error_format_message(p->error, "OOB in weights[%d,%d]", i, j);
+        /* Allow for stretching because of scale change */
+        if (oob_pixel(p->data, i, j)) {
+          driz_error_format_message(p->error, "OOB in data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
           return 1;
         } else {
-          w = get_pixel(p->weights, i, j) * p->weight_scale;
+          d = get_pixel(p->data, i, j) * dscale;
         }
-      } else {
-        w = 1.0;
-      }
-  
-      /* Loop over output pixels which could be affected */
-      min_jj = MAX(fortran_round(min_doubles(yout, 4)), 0);
-      max_jj = MIN(fortran_round(max_doubles(yout, 4)), osize[1]-1);
-      min_ii = MAX(fortran_round(min_doubles(xout, 4)), 0);
-      max_ii = MIN(fortran_round(max_doubles(xout, 4)), osize[0]-1);
+      
+        /* Scale the weighting mask by the scale factor and inversely by
+           the Jacobian to ensure conservation of weight in the output */
+        w = get_weight(p, i, j);
   
-      for (jj = min_jj; jj <= max_jj; ++jj) {
-        for (ii = min_ii; ii <= max_ii; ++ii) {
-          /* Call compute_area to calculate overlap */
-          dover = compute_area((double)ii, (double)jj, xout, yout);
+        /* Loop over output pixels which could be affected */
+        xmin = min_doubles(xout, 4);
+        xmax = max_doubles(xout, 4);
+        ymin = min_doubles(yout, 4);
+        ymax = max_doubles(yout, 4);
+
+        min_jj = MAX(fortran_round(ymin), 0);
+        max_jj = MIN(fortran_round(ymax), osize[1]-1);
+        min_ii = MAX(fortran_round(xmin), 0);
+        max_ii = MIN(fortran_round(xmax), osize[0]-1);
+  
+        for (jj = min_jj; jj <= max_jj; ++jj) {
+          if (rect) {
+            oy = over_interval(jj, ymin, ymax);
+            if (oy == 0.0) continue;
+          }
 
-          if (dover > 0.0) {
-            if (oob_pixel(p->output_counts, ii, jj)) {
-              driz_error_format_message(p->error, "OOB in output_counts[%d,%d]", ii, jj);
-              return 1;
+          for (ii = min_ii; ii <= max_ii; ++ii) {
+            if (rect) {
+              /* A rectangle's overlap is the product of 1-D overlaps */
+              dover = oy * over_interval(ii, xmin, xmax);
             } else {
-              vc = get_pixel(p->output_counts, ii, jj);
+              /* Call compute_area to calculate overlap */
+              dover = compute_area((double)ii, (double)jj, xout, yout);
             }
+
+            if (dover > 0.0) {
+              if (oob_pixel(p->output_counts, ii, jj)) {
+                driz_error_format_message(p->error, "OOB in output_counts[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
+                return 1;
+              } else {
+                vc = get_pixel(p->output_counts, ii, jj);
+              }
   
-            /* Re-normalise the area overlap using the Jacobian */
-            dover /= jaco;
-            dow = (float)(dover * w);
+              /* Re-normalise the area overlap using the Jacobian */
+              dover /= jaco;
+              dow = (float)(dover * w);
 
-            /* Count the hits */
-            ++nhit;  
+              /* Count the hits */
+              ++nhit;  
   
-            /* If we are creating or modifying the context image we do
-               so here */
-            if (p->output_context && dow > 0.0) {
-              if (oob_pixel(p->output_context, ii, jj)) {
-                driz_error_format_message(p->error, "OOB in output_context[%d,%d]", ii, jj);
-                return 1;
-              } else{
-                set_bit(p->output_context, ii, jj, bv);
+              /* If we are creating or modifying the context image we do
+                 so here */
+              if (p->output_context && dow > 0.0) {
+                if (oob_pixel(p->output_context, ii, jj)) {
+                  driz_error_format_message(p->error, "OOB in output_context[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", ii, jj);
+                  return 1;
+                } else{
+                  set_bit(p->output_context, ii, jj, bv);
+                }
               }
-            }
   
-            if (update_data(p, ii, jj, d, vc, dow)) {
-              return 1;
+              if (update_data(p, ii, jj, d, vc, dow)) {
+                return 1;
+              }
             }
           }
         }
-      }
   
-      /* Count cases where the pixel is off the output image */
-      _miss:
-      if (nhit == 0) {
-        ++ p->nmiss;
+        /* Count cases where the pixel is off the output image */
+        _miss:
+        if (nhit == 0) {
+          ++ p->nmiss;
+        }
       }
     }
   }
@@ -0,0 +1,177 @@
+#define NO_IMPORT_ARRAY
+#define NO_IMPORT_ASTROPY_WCS_API
+
+#include "driz_portability.h"
+#include "cdrizzlecr.h"
+#include "cdrizzleutil.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+/** --------------------------------------------------------------------------------------------------
+ * Largest absolute difference between a pixel and its neighbors along one axis. Neighbors
+ * outside the window and differences with NaN are ignored.
+ */
+
+static inline_macro float
+neighbor_difference(const float *pixel, const npy_intp step,
+                    const int has_before, const int has_after) {
+  float d, dmax = 0.0f;
+
+  if (has_before) {
+    d = fabsf(pixel[0] - pixel[-step]);
+    if (d > dmax) dmax = d;
+  }
+
+  if (has_after) {
+    d = fabsf(pixel[0] - pixel[step]);
+    if (d > dmax) dmax = d;
+  }
+
+  return dmax;
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Flag the cosmic rays in a window of an input image
+ *
+ * data:   the input image, in count rate units, dimensions (ny, nx)
+ * model:  the blotted median, in the same units and with the same dimensions. Pixels
+ *         with no model are NaN and are never flagged
+ * mask:   the mask, set to one for cosmic rays and zero otherwise on rows ystart
+ *         to ystop, with the same dimensions
+ * cr:     the thresholds and noise model
+ * ystart: the first row of the window to mask
+ * ystop:  one past the last row of the window to mask
+ * error:  error message, set if the dimensions do not match
+ */
+
+int
+cr_mask(PyArrayObject *data,
+        PyArrayObject *model,
+        PyArrayObject *mask,
+        const struct cr_param_t *cr,
+        const integer_t ystart,
+        const integer_t ystop,
+        struct driz_error_t *error) {
+
+  integer_t isize[2], msize[2], ksize[2];
+  integer_t i, j, ii, jj, nx, ny;
+  const float *dat, *mod;
+  unsigned char *out, *first = NULL, *second = NULL;
+  float *deriv = NULL;
+  float diff, noise, dx, dy;
+  size_t k, npix;
+  int hit;
+
+  assert(data);
+  assert(model);
+  assert(mask);
+  assert(cr);
+
+  get_dimensions(data, isize);
+  get_dimensions(model, msize);
+  get_dimensions(mask, ksize);
+
+  if (isize[0] != msize[0] || isize[1] != msize[1] ||
+      isize[0] != ksize[0] || isize[1] != ksize[1]) {
+    driz_error_set_message(error, "Data, model and mask dimensions do not match");
+    return 1;
+  }
+
+  if (ystart < 0 || ystop > isize[1] || ystart > ystop) {
+    driz_error_set_message(error, "Masked rows are outside the window");
+    return 1;
+  }
+
+  if (cr->gain <= 0.0f || cr->exptime <= 0.0f) {
+    driz_error_set_message(error, "Gain and exposure time must be > 0");
+    return 1;
+  }
+
+  nx = isize[0];
+  ny = isize[1];
+  npix = (size_t)nx * (size_t)ny;
+
+  dat = (const float *) PyArray_DATA(data);
+  mod = (const float *) PyArray_DATA(model);
+  out = (unsigned char *) PyArray_DATA(mask);
+
+  deriv = (float *) malloc(npix * sizeof(float));
+  first = (unsigned char *) calloc(npix, sizeof(unsigned char));
+  second = (unsigned char *) calloc(npix, sizeof(unsigned char));
+  if (deriv == NULL || first == NULL || second == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    goto cr_mask_exit_;
+  }
+
+  /* The derivative of the model, which measures how far it may be off
+   * where it changes quickly */
+
+  for (j = 0; j < ny; ++j) {
+    for (i = 0; i < nx; ++i) {
+      k = (size_t)j * nx + i;
+      dx = neighbor_difference(mod + k, 1, i > 0, i < nx - 1);
+      dy = neighbor_difference(mod + k, nx, j > 0, j < ny - 1);
+      deriv[k] = sqrtf(dx * dx + dy * dy);
+    }
+  }
+
+  /* First pass, pixels differing from the model by more than the noise
+   * and the allowance for the derivative */
+
+  for (k = 0; k < npix; ++k) {
+    diff = fabsf(dat[k] - mod[k]);
+    noise = sqrtf(cr->gain * fabsf((mod[k] + cr->sky) * cr->exptime) +
+                  cr->readnoise * cr->readnoise) / (cr->gain * cr->exptime);
+    first[k] = diff > cr->scale1 * deriv[k] + cr->snr1 * noise;
+  }
+
+  /* Second pass, pixels next to a cosmic ray with the lower threshold */
+
+  for (j = 0; j < ny; ++j) {
+    for (i = 0; i < nx; ++i) {
+      k = (size_t)j * nx + i;
+
+      hit = 0;
+      for (jj = MAX(j - 1, 0); jj <= MIN(j + 1, ny - 1) && !hit; ++jj) {
+        for (ii = MAX(i - 1, 0); ii <= MIN(i + 1, nx - 1); ++ii) {
+          if (first[(size_t)jj * nx + ii]) {
+            hit = 1;
+            break;
+          }
+        }
+      }
+      if (!hit) continue;
+
+      diff = fabsf(dat[k] - mod[k]);
+      noise = sqrtf(cr->gain * fabsf((mod[k] + cr->sky) * cr->exptime) +
+                    cr->readnoise * cr->readnoise) / (cr->gain * cr->exptime);
+      second[k] = diff > cr->scale2 * deriv[k] + cr->snr2 * noise;
+    }
+  }
+
+  /* Grow the mask over the masked rows */
+
+  for (j = ystart; j < ystop; ++j) {
+    for (i = 0; i < nx; ++i) {
+      hit = 0;
+      for (jj = MAX(j - cr->grow, 0); jj <= MIN(j + cr->grow, ny - 1) && !hit; ++jj) {
+        for (ii = MAX(i - cr->grow, 0); ii <= MIN(i + cr->grow, nx - 1); ++ii) {
+          if (second[(size_t)jj * nx + ii]) {
+            hit = 1;
+            break;
+          }
+        }
+      }
+      out[(size_t)j * nx + i] = (unsigned char) hit;
+    }
+  }
+
+ cr_mask_exit_:
+  if (deriv) free(deriv);
+  if (first) free(first);
+  if (second) free(second);
+
+  return driz_error_is_set(error);
+}
@@ -0,0 +1,47 @@
+#ifndef CDRIZZLECR_H
+#define CDRIZZLECR_H
+
+#include "cdrizzleutil.h"
+
+/**
+crreject
+
+This routine finds cosmic rays in an input image by comparing it with a
+model of the sky, the median of the drizzled inputs blotted back onto the
+input. A pixel is a cosmic ray if it differs from the model by more than
+the noise plus a fraction of the model's local derivative, which allows
+for errors in the model at sharp features. Pixels next to a cosmic ray
+are tested again with a lower threshold, and the mask may then be grown.
+
+The routine works on a window of rows, so an image may be processed in
+bands. A window must hold crgrow + 2 rows on each side of the rows it
+masks, where those exist in the image, for the result to be the same as
+for the whole image.
+
+It does not call the Python API, so it may be called with the global
+interpreter lock released.
+*/
+
+struct cr_param_t {
+  float gain;      /* Electrons per count of the input */
+  float readnoise; /* Read noise, in electrons */
+  float exptime;   /* Exposure time of the input */
+  float sky;       /* Sky level subtracted from the input, in its units */
+  float snr1;      /* Signal to noise threshold of the first pass */
+  float snr2;      /* Signal to noise threshold next to cosmic rays */
+  float scale1;    /* Fraction of the derivative allowed in the first pass */
+  float scale2;    /* Fraction of the derivative allowed next to cosmic rays */
+  integer_t grow;  /* Radius in pixels the final mask is grown by */
+};
+
+int
+cr_mask(PyArrayObject *data,
+        PyArrayObject *model,
+        PyArrayObject *mask,
+        const struct cr_param_t *cr,
+        const integer_t ystart,
+        const integer_t ystop,
+        struct driz_error_t *error
+       );
+
+#endif /* CDRIZZLECR_H */
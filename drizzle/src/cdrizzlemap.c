@@ -49,17 +49,17 @@ show_segment(struct segment *self, char *str) {
 /** --------------------------------------------------------------------------------------------------
  * Test if a pixmap vaue is bad (NaN)
  *
- * pixmap: the pixel mapping between input and output images
+ * p:      the structure holding the pixel mapping between input and output images
  * i:      the index of a pixel within a line
  * j:      the index of a line within an image
  */
 
 int
-bad_pixel(PyArrayObject *pixmap, int i, int j) {
+bad_pixel(struct driz_param_t *p, integer_t i, integer_t j) {
   int k;
   for (k = 0; k < 2; ++k) {
-    oob_pixel(pixmap, i, j);
-    if (npy_isnan(get_pixmap(pixmap, i, j)[k])) {
+    oob_pixel(p->pixmap, i, j);
+    if (npy_isnan(get_pixmap(p->pixmap, i, j)[k])) {
       return 1;
     }
   }
@@ -68,19 +68,19 @@ bad_pixel(PyArrayObject *pixmap, int i, int j) {
 }
 
 /** --------------------------------------------------------------------------------------------------
- * Test if weight value is bad (zero)
+ * Test if weight value is bad (zero), from the weights or data quality flags
  *
- * weights the weight to be given each pixel in an image
+ * p:      the structure holding the weights and flags of the input image
  * i:      the index of a pixel within a line
  * j:      the index of a line within an image
  */
 
 int
-bad_weight(PyArrayObject *weights, int i, int j) {
+bad_weight(struct driz_param_t *p, integer_t i, integer_t j) {
 
-  if (weights) {
-    oob_pixel(weights, i, j);
-    if (get_pixel(weights, i, j) == 0.0) {
+  if (has_pixel_weights(p)) {
+    oob_pixel(p->data, i, j);
+    if (get_weight(p, i, j) == 0.0) {
       return 1;
     } else {
       return 0;
@@ -93,25 +93,24 @@ bad_weight(PyArrayObject *weights, int i, int j) {
 /** --------------------------------------------------------------------------------------------------
  * Set the bounds of a segment to the range containing valid data
  *
- * self:    the segment
- * p:       the stucture containing the image pointers
- * pixmap:  array mapping input pixel coordinates to output pixel coordinates
- * weights: array of weights to apply when summing pixels
+ * self:         the segment
+ * p:            the stucture containing the image pointers
+ * is_bad_value: test of a pixel, bad_pixel for the pixmap or bad_weight for the weights
  */
 
 void
 shrink_segment(struct segment *self,
-               PyArrayObject *array,
-               int (*is_bad_value)(PyArrayObject *, int, int)) {
+               struct driz_param_t *p,
+               int (*is_bad_value)(struct driz_param_t *, integer_t, integer_t)) {
 
-  int i, j, imin, imax, jmin, jmax;
+  integer_t i, j, imin, imax, jmin, jmax;
 
   imin = self->point[1][0];
   jmin = self->point[1][1];
   
   for (j = self->point[0][1]; j < self->point[1][1]; ++j) {
     for (i = self->point[0][0]; i < self->point[1][0]; ++ i) {
-      if (! is_bad_value(array, i, j)) {
+      if (! is_bad_value(p, i, j)) {
         if (i < imin) {
           imin = i;
         }
@@ -128,7 +127,7 @@ shrink_segment(struct segment *self,
 
   for (j = self->point[1][1]; j > self->point[0][1]; --j) {  
     for (i = self->point[1][0]; i > self->point[0][0]; -- i) {
-      if (! is_bad_value(array, i-1, j-1)) {
+      if (! is_bad_value(p, i-1, j-1)) {
         if (i > imax) {
           imax = i;
         }
@@ -227,19 +226,19 @@ interpolation_bounds(
   PyArrayObject *pixmap,
   const double  xyin[2],
   int           idim,
-  int           *xypix
+  integer_t     *xypix
   ) {
 
-  int d;
+  integer_t d;
   int kdim;
   int iside;
-  int xy[2];
-  int xydim[2];
-  int xystart[2];
+  integer_t xy[2];
+  integer_t xydim[2];
+  integer_t xystart[2];
 
   int ipix = 0;
   int jdim = (idim + 1) % 2;
-  int *xyptr = xypix;
+  integer_t *xyptr = xypix;
   
   /* Starting point rounds down input pixel position
    * to integer value
@@ -325,13 +324,13 @@ interpolate_point(
   double        xyout[2] 
   ) {
 
-  int xypix[4][2];
+  integer_t xypix[4][2];
   double partial[4];
   int ipix, jpix, npix, idim;
 
   for (idim = 0; idim < 2; ++idim) {
     /* Find the four points that bound the linear interpolation */
-    if (interpolation_bounds(pixmap, xyin, idim, (int *)xypix)) {
+    if (interpolation_bounds(pixmap, xyin, idim, (integer_t *)xypix)) {
         return 1;
     }
 
@@ -372,8 +371,8 @@ interpolate_point(
 int
 map_pixel(
   PyArrayObject *pixmap, 
-  int           i,
-  int           j,
+  integer_t     i,
+  integer_t     j,
   double        xyout[2] 
   ) {
 
@@ -410,7 +409,8 @@ map_point(
   double        xyout[2] 
   ) {
 
-  int i, j, status, mapsize[2];
+  integer_t i, j, mapsize[2];
+  int status;
 
   i = xyin[0];
   j = xyin[1];
@@ -427,6 +427,76 @@ map_point(
   return status;
 }
 
+/** --------------------------------------------------------------------------------------------------
+ * Fit an affine map to the pixel map around a run of pixels on one line of the input image and
+ * check it reproduces the pixel map to within a tolerance. The check covers every pixel map value
+ * that map_point can read when mapping a point within one pixel of the run, so a successful fit
+ * can stand in for map_point anywhere in that range. Returns non-zero if the fit fails, which
+ * happens when the run is too close to the edge of the image, contains a NaN, or is not linear.
+ *
+ * pixmap:    the mapping of the pixel centers from input to output image
+ * imin:      the first pixel in the run
+ * imax:      one past the last pixel in the run
+ * j:         the line of the run
+ * tolerance: the largest allowed difference between the pixel map and the fit, in output pixels
+ * self:      the fitted affine map (output)
+ */
+
+int
+fit_affine_map(PyArrayObject *pixmap, integer_t imin, integer_t imax, integer_t j,
+               double tolerance, struct affine_map *self) {
+
+  integer_t i, jj, mapsize[2];
+  int k;
+  double *xyorigin, *xyend;
+
+  get_dimensions(pixmap, mapsize);
+  if (imax - imin < 1 || imin < 2 || imax + 1 >= mapsize[0] ||
+      j < 2 || j + 2 >= mapsize[1]) {
+    return 1;
+  }
+
+  self->origin[0] = imin;
+  self->origin[1] = j;
+
+  oob_pixel(pixmap, imin, j);
+  xyorigin = get_pixmap(pixmap, imin, j);
+
+  for (k = 0; k < 2; ++k) {
+    self->offset[k] = xyorigin[k];
+
+    oob_pixel(pixmap, imax + 1, j);
+    xyend = get_pixmap(pixmap, imax + 1, j);
+    self->slope[k][0] = (xyend[k] - xyorigin[k]) / (double) (imax + 1 - imin);
+
+    oob_pixel(pixmap, imin, j + 2);
+    xyend = get_pixmap(pixmap, imin, j + 2);
+    self->slope[k][1] = (xyend[k] - xyorigin[k]) / 2.0;
+  }
+
+  /* The comparison is written so that a NaN fails it */
+  for (jj = j - 2; jj <= j + 2; ++jj) {
+    for (i = imin - 2; i <= imax + 1; ++i) {
+      double *xypix;
+
+      oob_pixel(pixmap, i, jj);
+      xypix = get_pixmap(pixmap, i, jj);
+
+      for (k = 0; k < 2; ++k) {
+        double xyfit = self->offset[k] +
+                       self->slope[k][0] * (double) (i - imin) +
+                       self->slope[k][1] * (double) (jj - j);
+
+        if (! (fabs(xypix[k] - xyfit) <= tolerance)) {
+          return 1;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
 /** --------------------------------------------------------------------------------------------------
  * Clip a line segment from an input image to the limits of an output image along one dimension
  *
@@ -574,15 +644,18 @@ check_line_overlap(struct driz_param_t* p, int margin, integer_t j, integer_t *x
                      osize[0] + margin, osize[1] + margin);
 
   initialize_segment(&xybounds, p->xmin, j, p->xmax, j+1);
-  shrink_segment(&xybounds, p->pixmap, &bad_pixel);
+  shrink_segment(&xybounds, p, &bad_pixel);
   
   if (clip_bounds(p->pixmap, &outlimit, &xybounds)) {
     driz_error_set_message(p->error, "cannot compute xbounds");
     return 1;
   }
 
+  /* Uniform weights have no zeros to trim */
   sort_segment(&xybounds, 0);
-  shrink_segment(&xybounds, p->weights, &bad_weight);
+  if (has_pixel_weights(p)) {
+    shrink_segment(&xybounds, p, &bad_weight);
+  }
 
   xbounds[0] = floor(xybounds.point[0][0]);
   xbounds[1] = ceil(xybounds.point[1][0]);
@@ -619,7 +692,7 @@ check_image_overlap(struct driz_param_t* p, const int margin, integer_t *ybounds
                      osize[0] + margin, osize[1] + margin);
 
   initialize_segment(&inlimit, p->xmin, p->ymin, p->xmax, p->ymax);
-  shrink_segment(&inlimit, p->pixmap, &bad_pixel);
+  shrink_segment(&inlimit, p, &bad_pixel);
   
   if (inlimit.invalid == 1) {
       driz_error_set_message(p->error, "no valid pixels on input image");
@@ -15,6 +15,18 @@ struct segment {
     int     invalid;
 };
 
+/* Affine approximation of the pixel map over a run of pixels on one line
+ * The origin is the input pixel the approximation is expanded around
+ * The offset is the output position of the origin
+ * The first index on slope is the output coordinate, the second the input
+ */
+
+struct affine_map {
+    double  origin[2];
+    double  offset[2];
+    double  slope[2][2];
+};
+
 void
 initialize_segment(struct segment *self,
                    integer_t x1,
@@ -29,21 +41,21 @@ show_segment(struct segment *self,
             );
 
 int
-bad_pixel(PyArrayObject *pixmap,
-          int i,
-          int j
+bad_pixel(struct driz_param_t *p,
+          integer_t i,
+          integer_t j
           );
 
 int
-bad_weight(PyArrayObject *weights,
-           int i,
-           int j
+bad_weight(struct driz_param_t *p,
+           integer_t i,
+           integer_t j
            );
 
 void
 shrink_segment(struct segment *self,
-               PyArrayObject *array,
-               int (*is_bad_value)(PyArrayObject *, int, int)
+               struct driz_param_t *p,
+               int (*is_bad_value)(struct driz_param_t *, integer_t, integer_t)
                );
 
 void
@@ -65,11 +77,20 @@ map_point(PyArrayObject * pixmap,
 
 int
 map_pixel(PyArrayObject *pixmap, 
-          int    i,
-          int    j,
+          integer_t i,
+          integer_t j,
           double xyout[2] 
          );
 
+int
+fit_affine_map(PyArrayObject *pixmap,
+               integer_t imin,
+               integer_t imax,
+               integer_t j,
+               double tolerance,
+               struct affine_map *self
+              );
+
 int
 clip_bounds(PyArrayObject *pixmap,
             struct segment *xylimit,
@@ -0,0 +1,308 @@
+#define NO_IMPORT_ARRAY
+#define NO_IMPORT_ASTROPY_WCS_API
+
+#include "driz_portability.h"
+#include "cdrizzlemerge.h"
+#include "cdrizzleutil.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <numpy/npy_math.h>
+
+/** --------------------------------------------------------------------------------------------------
+ * Number of elements in an array
+ */
+
+static npy_intp
+array_size(PyArrayObject *array) {
+  int i;
+  npy_intp size = 1;
+
+  for (i = 0; i < PyArray_NDIM(array); ++i) {
+    size *= PyArray_DIM(array, i);
+  }
+
+  return size;
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Combine a stack of images as a weighted mean
+ *
+ * data:           stack of images, dimensions (nproduct, ny, nx)
+ * weights:        stack of weights with the same dimensions as data
+ * scale:          factor multiplying each image of the stack, nproduct values
+ * output_data:    combined image, dimensions (ny, nx)
+ * output_weights: summed weights, dimensions (ny, nx)
+ * fill_value:     value of output pixels with no weight
+ * error:          error message, set if the dimensions do not match
+ */
+
+int
+merge_weighted(PyArrayObject *data,
+               PyArrayObject *weights,
+               const double *scale,
+               PyArrayObject *output_data,
+               PyArrayObject *output_weights,
+               const float fill_value,
+               struct driz_error_t *error) {
+
+  npy_intp k, n, nproduct, npix;
+  const float *dat, *wei;
+  float *odat, *owei;
+  double sum_data, sum_weight, w;
+
+  assert(data);
+  assert(weights);
+  assert(scale);
+  assert(output_data);
+  assert(output_weights);
+
+  nproduct = PyArray_DIM(data, 0);
+  npix = array_size(output_data);
+
+  if (array_size(data) != nproduct * npix ||
+      array_size(weights) != nproduct * npix ||
+      array_size(output_weights) != npix) {
+    driz_error_set_message(error, "Merged image dimensions do not match");
+    return 1;
+  }
+
+  dat = (const float *) PyArray_DATA(data);
+  wei = (const float *) PyArray_DATA(weights);
+  odat = (float *) PyArray_DATA(output_data);
+  owei = (float *) PyArray_DATA(output_weights);
+
+  /* Sum in double precision so the result does not depend on the order
+   * of the products. Products with zero weight may hold a fill value and
+   * are skipped. */
+
+  for (n = 0; n < npix; ++n) {
+    sum_data = 0.0;
+    sum_weight = 0.0;
+
+    for (k = 0; k < nproduct; ++k) {
+      w = wei[k * npix + n];
+      if (w != 0.0) {
+        sum_data += w * scale[k] * dat[k * npix + n];
+        sum_weight += w;
+      }
+    }
+
+    if (sum_weight != 0.0) {
+      odat[n] = (float) (sum_data / sum_weight);
+    } else {
+      odat[n] = fill_value;
+    }
+    owei[n] = (float) sum_weight;
+  }
+
+  return 0;
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Partially order values so the kth is in place, with no larger value before it and no
+ * smaller value after it
+ */
+
+static void
+select_kth(float *values, npy_intp n, const npy_intp k) {
+  npy_intp lo = 0, hi = n - 1, i, j;
+  float pivot, swap;
+
+  while (lo < hi) {
+    pivot = values[lo + (hi - lo) / 2];
+    i = lo;
+    j = hi;
+
+    while (i <= j) {
+      while (values[i] < pivot) ++i;
+      while (values[j] > pivot) --j;
+      if (i <= j) {
+        swap = values[i];
+        values[i] = values[j];
+        values[j] = swap;
+        ++i;
+        --j;
+      }
+    }
+
+    if (k <= j) {
+      hi = j;
+    } else if (k >= i) {
+      lo = i;
+    } else {
+      break;
+    }
+  }
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Combine a stack of images as the median of each pixel, ignoring values with no weight
+ *
+ * data:           stack of images, dimensions (nimage, ny, nx)
+ * weights:        stack of weights with the same dimensions as data
+ * output_data:    combined image, dimensions (ny, nx)
+ * minmed:         if set, use the minimum where the median is well above it
+ * nsigma:         for minmed, the number of standard deviations of the minimum
+ *                 the median must exceed it by
+ * gain:           for minmed, electrons per unit of the images
+ * readnoise:      for minmed, the read noise in electrons
+ * fill_value:     value of output pixels with no weight
+ * error:          error message, set if the dimensions do not match
+ */
+
+int
+merge_median(PyArrayObject *data,
+             PyArrayObject *weights,
+             PyArrayObject *output_data,
+             const int minmed,
+             const float nsigma,
+             const float gain,
+             const float readnoise,
+             const float fill_value,
+             struct driz_error_t *error) {
+
+  npy_intp k, n, nimage, npix, nvalue, half;
+  const float *dat, *wei;
+  float *odat, *values;
+  float value, lower, median, minimum, sigma;
+
+  assert(data);
+  assert(weights);
+  assert(output_data);
+
+  nimage = PyArray_DIM(data, 0);
+  npix = array_size(output_data);
+
+  if (array_size(data) != nimage * npix ||
+      array_size(weights) != nimage * npix) {
+    driz_error_set_message(error, "Merged image dimensions do not match");
+    return 1;
+  }
+
+  if (minmed && gain <= 0.0f) {
+    driz_error_set_message(error, "Gain must be > 0");
+    return 1;
+  }
+
+  dat = (const float *) PyArray_DATA(data);
+  wei = (const float *) PyArray_DATA(weights);
+  odat = (float *) PyArray_DATA(output_data);
+
+  values = (float *) malloc((nimage > 0 ? nimage : 1) * sizeof(float));
+  if (values == NULL) {
+    driz_error_set_message(error, "Out of memory");
+    return 1;
+  }
+
+  for (n = 0; n < npix; ++n) {
+    nvalue = 0;
+    minimum = 0.0f;
+
+    for (k = 0; k < nimage; ++k) {
+      value = dat[k * npix + n];
+      if (wei[k * npix + n] > 0.0f && ! npy_isnan(value)) {
+        if (nvalue == 0 || value < minimum) minimum = value;
+        values[nvalue++] = value;
+      }
+    }
+
+    if (nvalue == 0) {
+      odat[n] = fill_value;
+      continue;
+    }
+
+    /* An even number of values has the mean of the middle two, the
+     * lower of which is the largest value before the upper */
+    half = nvalue / 2;
+    select_kth(values, nvalue, half);
+    median = values[half];
+
+    if (nvalue % 2 == 0) {
+      lower = values[0];
+      for (k = 1; k < half; ++k) {
+        if (values[k] > lower) lower = values[k];
+      }
+      median = 0.5f * (lower + median);
+    }
+
+    /* The median of few images is pulled up by cosmic rays in any of
+     * them, the minimum is not */
+    if (minmed) {
+      sigma = sqrtf(readnoise * readnoise + gain * fabsf(minimum)) / gain;
+      if (median - minimum > nsigma * sigma) {
+        median = minimum;
+      }
+    }
+
+    odat[n] = median;
+  }
+
+  free(values);
+  return 0;
+}
+
+/** --------------------------------------------------------------------------------------------------
+ * Merge the context bits of one product into the combined context image
+ *
+ * context:        context image of the product, dimensions (nplane, ny, nx)
+ * output_context: combined context image, dimensions (noplane, ny, nx)
+ * offset:         number of images drizzled into the products before this one
+ * error:          error message, set if the dimensions do not match
+ */
+
+int
+merge_context(PyArrayObject *context,
+              PyArrayObject *output_context,
+              const integer_t offset,
+              struct driz_error_t *error) {
+
+  npy_intp n, plane, nplane, noplane, npix;
+  npy_intp oplane, shift;
+  const uint32_t *con;
+  uint32_t *ocon, bits, high;
+
+  assert(context);
+  assert(output_context);
+
+  nplane = PyArray_DIM(context, 0);
+  noplane = PyArray_DIM(output_context, 0);
+  npix = array_size(context) / (nplane > 0 ? nplane : 1);
+
+  if (offset < 0 || array_size(output_context) != noplane * npix) {
+    driz_error_set_message(error, "Merged context dimensions do not match");
+    return 1;
+  }
+
+  con = (const uint32_t *) PyArray_DATA(context);
+  ocon = (uint32_t *) PyArray_DATA(output_context);
+
+  /* Bit b of plane p is image 32 * p + b of the product and moves to
+   * image 32 * p + b + offset of the combined product, which may
+   * straddle two output planes. */
+
+  oplane = offset / 32;
+  shift = offset % 32;
+
+  for (plane = 0; plane < nplane; ++plane, ++oplane) {
+    for (n = 0; n < npix; ++n) {
+      bits = con[plane * npix + n];
+      if (bits == 0) continue;
+
+      high = shift != 0 ? bits >> (32 - shift) : 0;
+      if (oplane >= noplane || (high != 0 && oplane + 1 >= noplane)) {
+        driz_error_set_message(error, "Merged context has too few planes");
+        return 1;
+      }
+
+      ocon[oplane * npix + n] |= bits << shift;
+      if (high != 0) {
+        ocon[(oplane + 1) * npix + n] |= high;
+      }
+    }
+  }
+
+  return 0;
+}
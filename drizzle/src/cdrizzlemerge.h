@@ -0,0 +1,49 @@
+#ifndef CDRIZZLEMERGE_H
+#define CDRIZZLEMERGE_H
+
+#include "cdrizzleutil.h"
+
+/**
+merge
+
+These routines combine partial products drizzled separately, for
+instance by different processes, into a single product. The images are
+combined as a weighted mean and the context bits of each product are
+shifted past the bits of the products before it, so that each input
+image keeps a distinct bit. Images drizzled one at a time may instead be
+combined as their median, a model of the sky free of cosmic rays.
+
+None of these routines calls the Python API, so they may be called with
+the global interpreter lock released.
+*/
+
+int
+merge_weighted(PyArrayObject *data,
+               PyArrayObject *weights,
+               const double *scale,
+               PyArrayObject *output_data,
+               PyArrayObject *output_weights,
+               const float fill_value,
+               struct driz_error_t *error
+              );
+
+int
+merge_median(PyArrayObject *data,
+             PyArrayObject *weights,
+             PyArrayObject *output_data,
+             const int minmed,
+             const float nsigma,
+             const float gain,
+             const float readnoise,
+             const float fill_value,
+             struct driz_error_t *error
+            );
+
+int
+merge_context(PyArrayObject *context,
+              PyArrayObject *output_context,
+              const integer_t offset,
+              struct driz_error_t *error
+             );
+
+#endif /* CDRIZZLEMERGE_H */
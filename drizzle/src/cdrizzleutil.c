@@ -126,18 +126,38 @@ driz_param_init(struct driz_param_t* p) {
   p->in_units = unit_counts;
   p->out_units = unit_counts;
 
+  /* Weighted mean of the data */
+  p->sum_data = 0;
+
   p->scale = 1.0;
+  p->affine_tolerance = 1.0e-6;
 
   /* Input data */
   p->data = NULL;
   p->weights = NULL;
   p->pixmap = NULL;
+  p->dq = NULL;
+  p->dq_bits = 0;
+
+  /* Weights are not inverse variance */
+  p->ivm = 0;
+  p->ivm_sky = 0.0;
+  p->ivm_noise = 0.0;
+  p->ivm_sky_map = NULL;
+  p->ivm_flat = NULL;
 
   /* Output data */
   p->output_data = NULL;
   p->output_counts = NULL;
   p->output_context = NULL;
 
+  p->nplane = 1;
+  p->data_planes = NULL;
+  p->output_planes = NULL;
+
+  p->output_dirty = NULL;
+  p->data_dirty = NULL;
+
   p->nmiss = 0;
   p->nskip = 0;
   p->error = NULL;
@@ -293,11 +313,11 @@ put_fill(struct driz_param_t* p, const float fill_value) {
   for (j = 0; j < osize[1]; ++j) {
     for (i = 0; i < osize[0]; ++i) {
       if (oob_pixel(p->output_counts, i, j)) {
-        driz_error_format_message(p->error, "OOB in output_counts[%d,%d]", i, j);
+        driz_error_format_message(p->error, "OOB in output_counts[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
         return;
 
       } else if (oob_pixel(p->output_data, i, j)) {
-        driz_error_format_message(p->error, "OOB in output_data[%d,%d]", i, j);
+        driz_error_format_message(p->error, "OOB in output_data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT "]", i, j);
         return;
 
       } else if (get_pixel(p->output_counts, i, j) == 0.0) {
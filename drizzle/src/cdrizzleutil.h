@@ -61,6 +61,9 @@ void driz_error_unset(struct driz_error_t* error);
 #define MAX_COEFFS 128
 #define COEFF_OFFSET 100
 
+/* Side of the square tiles used to track which parts of an image changed */
+#define DRIZ_TILE_SIZE 64
+
 #undef TRUE
 #define TRUE 1
 
@@ -70,7 +73,8 @@ void driz_error_unset(struct driz_error_t* error);
 /*****************************************************************
  DATA TYPES
 */
-typedef int integer_t;
+/* Pixel indices and counts, wide enough for images over 2^31 pixels */
+typedef npy_intp integer_t;
 #if __STDC_VERSION__ >= 199901L
 typedef int_fast8_t bool_t;
 #else
@@ -127,10 +131,15 @@ struct driz_param_t {
   enum e_unit_t   in_units; /* CPS / counts was: INCPS, either counts or CPS */
   enum e_unit_t   out_units; /* CPS / counts was: INCPS, either counts or CPS */
   integer_t       uuid; /* was: UNIQID */
+  bool_t          sum_data; /* Accumulate the weighted sum of the data, not its mean */
 
   /* Scaling */
   double scale;
 
+  /* Largest pixmap error, in output pixels, allowed when a kernel replaces
+     the pixmap with a local affine fit. Negative values disable the fit */
+  double affine_tolerance;
+
   /* Image subset */
   integer_t xmin;
   integer_t xmax;
@@ -149,11 +158,36 @@ struct driz_param_t {
   PyArrayObject *weights;
   PyArrayObject *pixmap;
 
+  /* Data quality flags of the input, uint16 or uint32, may be NULL. Pixels
+     with any flag set that is not in dq_bits have zero weight */
+  PyArrayObject *dq;
+  npy_uint32 dq_bits;
+
+  /* Inverse variance weighting, if ivm is set. The weight of a pixel is
+     multiplied by f^2 / (s f + ivm_noise), for the flat field f and the sky
+     s in electrons, where f and s are read from ivm_flat and ivm_sky_map if
+     they are not NULL. The square of the exposure time is in weight_scale */
+  bool_t ivm;
+  float ivm_sky;
+  float ivm_noise; /* Dark plus read noise squared, in electrons */
+  PyArrayObject *ivm_sky_map;
+  PyArrayObject *ivm_flat;
+
   /* Output images */
   PyArrayObject *output_data; 
   PyArrayObject *output_counts;  /* was: COU */
   PyArrayObject *output_context; /* was: CONTIM */
 
+  /* Planes blotted through the same pixmap, may be NULL. When set, each
+     holds nplane images and data and output_data are their first planes */
+  integer_t nplane;
+  PyArrayObject **data_planes;
+  PyArrayObject **output_planes;
+
+  /* Maps of changed tiles, may be NULL */
+  PyArrayObject *output_dirty; /* Set by drizzling for each tile of output changed */
+  PyArrayObject *data_dirty; /* Read by blotting to skip input tiles not changed */
+
   /* Other output */
   integer_t nmiss;
   integer_t nskip;
@@ -249,8 +283,8 @@ oob_pixel(PyArrayObject *image, integer_t xpix, integer_t ypix) {
   if (ypix < 0 || ypix >= ndim[0]) flag = 1;
 
   if (flag) {
-    sprintf(buffer, "Point [%d,%d] is outside of [%d, %d]",
-            xpix, ypix, (int) ndim[1], (int) ndim[0]);
+    sprintf(buffer, "Point [%" NPY_INTP_FMT ",%" NPY_INTP_FMT "] is outside of [%"
+            NPY_INTP_FMT ", %" NPY_INTP_FMT "]", xpix, ypix, ndim[1], ndim[0]);
     driz_log_message(buffer);
   }
   
@@ -281,23 +315,88 @@ set_pixel(PyArrayObject *image, integer_t xpix, integer_t ypix, double value) {
 
 static inline_macro int
 get_bit(PyArrayObject *image, integer_t xpix, integer_t ypix, integer_t bitval) {
-  integer_t value;
-  value = *(integer_t*) PyArray_GETPTR2(image, ypix, xpix) & bitval;
+  npy_int32 value;
+  value = *(npy_int32*) PyArray_GETPTR2(image, ypix, xpix) & (npy_int32) bitval;
   return value? 1 : 0;
 }
 
 static inline_macro void
 set_bit(PyArrayObject *image, integer_t xpix, integer_t ypix, integer_t bitval) {  
-  *(integer_t*) PyArray_GETPTR2(image, ypix, xpix) |= bitval;
+  *(npy_int32*) PyArray_GETPTR2(image, ypix, xpix) |= (npy_int32) bitval;
   return;
 }
 
 static inline_macro void
 unset_bit(PyArrayObject *image, integer_t xpix, integer_t ypix) {
-  *(integer_t*) PyArray_GETPTR2(image, ypix, xpix) = 0;
+  *(npy_int32*) PyArray_GETPTR2(image, ypix, xpix) = 0;
+  return;
+}
+
+static inline_macro int
+get_dirty(PyArrayObject *dirty, integer_t xpix, integer_t ypix) {
+  return *(unsigned char*) PyArray_GETPTR2(dirty, ypix / DRIZ_TILE_SIZE,
+                                           xpix / DRIZ_TILE_SIZE) != 0;
+}
+
+static inline_macro void
+set_dirty(PyArrayObject *dirty, integer_t xpix, integer_t ypix) {
+  *(unsigned char*) PyArray_GETPTR2(dirty, ypix / DRIZ_TILE_SIZE,
+                                    xpix / DRIZ_TILE_SIZE) = 1;
   return;
 }
 
+static inline_macro npy_uint32
+get_dq(PyArrayObject *dq, integer_t xpix, integer_t ypix) {
+  if (PyArray_TYPE(dq) == NPY_UINT16) {
+    return *(npy_uint16*) PyArray_GETPTR2(dq, ypix, xpix);
+  } else {
+    return *(npy_uint32*) PyArray_GETPTR2(dq, ypix, xpix);
+  }
+}
+
+static inline_macro float
+get_ivm(struct driz_param_t *p, integer_t xpix, integer_t ypix) {
+  float sky, flat, variance;
+
+  sky = p->ivm_sky_map ? get_pixel(p->ivm_sky_map, xpix, ypix) : p->ivm_sky;
+  flat = p->ivm_flat ? get_pixel(p->ivm_flat, xpix, ypix) : 1.0f;
+  variance = sky * flat + p->ivm_noise;
+
+  return variance > 0.0f ? flat * flat / variance : 0.0f;
+}
+
+/* True if the weight varies from pixel to pixel, otherwise every pixel
+   has the weight scale and no weights need to be read */
+
+static inline_macro bool_t
+has_pixel_weights(struct driz_param_t *p) {
+  return p->weights != NULL || p->dq != NULL || p->ivm;
+}
+
+/* The weight of an input pixel, zero if it has a data quality flag
+   not in dq_bits */
+
+static inline_macro float
+get_weight(struct driz_param_t *p, integer_t xpix, integer_t ypix) {
+  float w;
+
+  if (! has_pixel_weights(p)) {
+    return p->weight_scale;
+  } else if (p->dq && (get_dq(p->dq, xpix, ypix) & ~p->dq_bits)) {
+    return 0.0f;
+  } else if (p->weights) {
+    w = get_pixel(p->weights, xpix, ypix) * p->weight_scale;
+  } else {
+    w = p->weight_scale;
+  }
+
+  if (p->ivm) {
+    w *= get_ivm(p, xpix, ypix);
+  }
+
+  return w;
+}
+
 /*****************************************************************
  STRING TO ENUMERATION CONVERSIONS
 */
@@ -395,7 +494,7 @@ min_doubles(const double* a, const integer_t size) {
 static inline_macro double
 max_doubles(const double* a, const integer_t size) {
   const double* end = a + size;
-  double value = MIN_DOUBLE;
+  double value = - MAX_DOUBLE;
   for ( ; a != end; ++a)
     if (*a > value)
       value = *a;
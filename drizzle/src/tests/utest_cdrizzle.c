@@ -138,6 +138,28 @@ offset_pixmap(struct driz_param_t *p, double x_offset, double y_offset) {
     return;
 }
 
+void
+rotate_pixmap(struct driz_param_t *p, double angle, double scale) {
+    
+    int i, j;
+    double xcen, ycen, xpix, ypix;
+
+    xcen = 0.5 * image_size[0];
+    ycen = 0.5 * image_size[1];
+    for (j = 0; j < image_size[1]; j++) {
+       ypix = j - ycen;
+       for (i = 0; i < image_size[0]; i++) {
+            xpix = i - xcen;
+            get_pixmap(p->pixmap, i, j)[0] =
+                xcen + scale * (cos(angle) * xpix - sin(angle) * ypix);
+            get_pixmap(p->pixmap, i, j)[1] =
+                ycen + scale * (sin(angle) * xpix + cos(angle) * ypix);
+       }
+    }
+
+    return;
+}
+
 void
 fill_image(PyArrayObject *image, double value) {
     npy_intp   *ndim = PyArray_DIMS(image);
@@ -399,7 +421,7 @@ FCT_BGN_FN(utest_cdrizzle)
             initialize_segment(&xylimits, p->xmin, p->ymin, p->xmax, p->ymax);  
             initialize_segment(&xybounds, p->xmin, p->ymin, p->xmax, p->ymax);  
             
-            shrink_segment(&xybounds, p->pixmap, &bad_pixel);
+            shrink_segment(&xybounds, p, &bad_pixel);
             
             for (i = 0; i < 2; ++i) {
                 for (j = 0; j < 2; ++j) {
@@ -429,7 +451,7 @@ FCT_BGN_FN(utest_cdrizzle)
             initialize_segment(&xylimits, nan_max, p->ymin, p->xmax, p->ymax);  
             initialize_segment(&xybounds, p->xmin, p->ymin, p->xmax, p->ymax);  
             
-            shrink_segment(&xybounds, p->pixmap, &bad_pixel);
+            shrink_segment(&xybounds, p, &bad_pixel);
 
             for (i = 0; i < 2; ++i) {
                 for (j = 0; j < 2; ++j) {
@@ -458,7 +480,7 @@ FCT_BGN_FN(utest_cdrizzle)
             initialize_segment(&xylimits, nan_min, nan_min, nan_max, nan_max);
             initialize_segment(&xybounds, p->xmin, p->ymin, p->xmax, p->ymax);  
 
-            shrink_segment(&xybounds, p->pixmap, &bad_pixel);
+            shrink_segment(&xybounds, p, &bad_pixel);
             for (i = 0; i < 2; ++i) {
                 for (j = 0; j < 2; ++j) {
                     fct_chk_eq_dbl(xybounds.point[i][j], xylimits.point[i][j]);
@@ -551,6 +573,80 @@ FCT_BGN_FN(utest_cdrizzle)
         }
         FCT_TEST_END();
         
+        FCT_TEST_BGN(utest_fit_affine_map_01)
+        {
+            /* Fit over a linear pixel map */
+
+            struct affine_map fit;
+            struct driz_param_t *p;
+            int status;
+
+            p = setup_parameters();
+            stretch_pixmap(p, 1000.0);
+
+            status = fit_affine_map(p->pixmap, 10, 26, 10, 1.0e-5, &fit);
+
+            fct_chk_eq_int(status, 0);
+            fct_chk_eq_dbl(fit.origin[0], 10.0);
+            fct_chk_eq_dbl(fit.origin[1], 10.0);
+            fct_chk_eq_dbl(fit.offset[0], 10.0);
+            fct_chk_eq_dbl(fit.offset[1], 10000.0);
+            fct_chk_eq_dbl(fit.slope[0][0], 1.0);
+            fct_chk_eq_dbl(fit.slope[0][1], 0.0);
+            fct_chk_eq_dbl(fit.slope[1][0], 0.0);
+            fct_chk_eq_dbl(fit.slope[1][1], 1000.0);
+
+            teardown_parameters(p);
+        }
+        FCT_TEST_END();
+
+        FCT_TEST_BGN(utest_fit_affine_map_02)
+        {
+            /* Fit rejected by a NaN on a neighboring line */
+
+            struct affine_map fit;
+            struct driz_param_t *p;
+            int status;
+
+            p = setup_parameters();
+            stretch_pixmap(p, 1000.0);
+            nan_pixel(p, 20, 12);
+
+            status = fit_affine_map(p->pixmap, 10, 26, 10, 1.0e-5, &fit);
+            fct_chk_eq_int(status, 1);
+
+            teardown_parameters(p);
+        }
+        FCT_TEST_END();
+
+        FCT_TEST_BGN(utest_fit_affine_map_03)
+        {
+            /* Fit rejected by distortion and at the image edge */
+
+            struct affine_map fit;
+            struct driz_param_t *p;
+            int status;
+
+            p = setup_parameters();
+            get_pixmap(p->pixmap, 25, 8)[0] += 0.01;
+
+            status = fit_affine_map(p->pixmap, 10, 26, 10, 1.0e-5, &fit);
+            fct_chk_eq_int(status, 1);
+
+            status = fit_affine_map(p->pixmap, 10, 26, 10, 0.1, &fit);
+            fct_chk_eq_int(status, 0);
+
+            status = fit_affine_map(p->pixmap, 1, 17, 10, 1.0e-5, &fit);
+            fct_chk_eq_int(status, 1);
+
+            status = fit_affine_map(p->pixmap, 10, 26, image_size[1] - 2,
+                                    1.0e-5, &fit);
+            fct_chk_eq_int(status, 1);
+
+            teardown_parameters(p);
+        }
+        FCT_TEST_END();
+
         FCT_TEST_BGN(utest_check_line_overlap_01)
         {
             /* Test for complete overlap */
@@ -1020,6 +1116,81 @@ FCT_BGN_FN(utest_cdrizzle)
         }
         FCT_TEST_END();
 
+        FCT_TEST_BGN(utest_do_kernel_square_08)
+        {
+            /* Affine fit agrees with exact mapping on a rotated image */
+
+            struct driz_param_t *p;     /* parameter structure */
+            integer_t i, j, npix, nbad;
+            float *expected;
+
+            p = setup_parameters();
+            p->pixel_fraction = 0.7;
+            rotate_pixmap(p, 0.3, 0.9);
+
+            for (j = 0; j < image_size[1]; ++j) {
+                for (i = 0; i < image_size[0]; ++i) {
+                    set_pixel(p->data, i, j, (float) ((i + 3 * j) % 7));
+                }
+            }
+
+            p->affine_tolerance = -1.0;
+            do_kernel_square(p);
+
+            npix = image_size[0] * image_size[1];
+            expected = (float *) malloc(npix * sizeof(float));
+            for (j = 0; j < image_size[1]; ++j) {
+                for (i = 0; i < image_size[0]; ++i) {
+                    expected[i + j * image_size[0]] = get_pixel(p->output_data, i, j);
+                }
+            }
+
+            fill_image(p->output_data, 0.0);
+            fill_image(p->output_counts, 0.0);
+            p->affine_tolerance = 1.0e-6;
+            do_kernel_square(p);
+
+            nbad = 0;
+            for (j = 0; j < image_size[1]; ++j) {
+                for (i = 0; i < image_size[0]; ++i) {
+                    if (fabs(get_pixel(p->output_data, i, j) -
+                             expected[i + j * image_size[0]]) > 1.0e-5) {
+                        ++ nbad;
+                    }
+                }
+            }
+
+            fct_chk_eq_int(nbad, 0);
+
+            free(expected);
+            teardown_parameters(p);
+        }
+        FCT_TEST_END();
+
+        FCT_TEST_BGN(utest_do_kernel_square_09)
+        {
+            /* Single pixel, fractional offset, shrunken drop */
+
+            struct driz_param_t *p;     /* parameter structure */
+
+            p = setup_parameters();
+            p->pixel_fraction = 0.5;
+            offset_pixmap(p, 2.4, 2.4);
+            set_pixel(p->data, 2, 2, 1.0);
+
+            do_kernel_square(p);
+
+            fct_chk(fabs(get_pixel(p->output_data, 4, 4) - 0.49) < 1.0e-6);
+            fct_chk(fabs(get_pixel(p->output_data, 4, 5) - 0.21) < 1.0e-6);
+            fct_chk(fabs(get_pixel(p->output_data, 5, 4) - 0.21) < 1.0e-6);
+            fct_chk(fabs(get_pixel(p->output_data, 5, 5) - 0.09) < 1.0e-6);
+            fct_chk(fabs(get_pixel(p->output_counts, 4, 4) - 1.0) < 1.0e-6);
+            fct_chk(fabs(get_pixel(p->output_counts, 5, 5) - 1.0) < 1.0e-6);
+
+            teardown_parameters(p);
+        }
+        FCT_TEST_END();
+
         FCT_TEST_BGN(utest_dobox_01)
         {
             /* Single pixel set, whole number offset */
@@ -1134,6 +1305,36 @@ FCT_BGN_FN(utest_cdrizzle)
         }
         FCT_TEST_END();
 
+        FCT_TEST_BGN(utest_dobox_05)
+        {
+            /* Single pixel set, tophat kernel */
+
+            struct driz_param_t *p;     /* parameter structure */
+            int k;
+            double value;
+
+            k = 10;
+            value = 9.0;
+
+            p = setup_parameters();
+            p->kernel = kernel_tophat;
+            p->pixel_fraction = 3.0;
+
+            set_pixel(p->data, k, k, value);
+            dobox(p);
+
+            fct_chk(fabs(get_pixel(p->output_data, k, k) - 1.0) < 1.0e-6);
+            fct_chk(fabs(get_pixel(p->output_data, k+1, k+1) - 1.0) < 1.0e-6);
+            fct_chk(fabs(get_pixel(p->output_data, k-1, k+1) - 1.0) < 1.0e-6);
+            fct_chk_eq_dbl(get_pixel(p->output_data, k+2, k), 0.0);
+            fct_chk_eq_dbl(get_pixel(p->output_data, k, k-2), 0.0);
+            fct_chk_eq_dbl(get_pixel(p->output_counts, k, k), 9.0);
+            fct_chk_eq_dbl(get_pixel(p->output_counts, 0, 0), 4.0);
+
+            teardown_parameters(p);
+        }
+        FCT_TEST_END();
+
         FCT_TEST_BGN(utest_doblot_01)
         {
             /* Single pixel set blinear interpolation */
@@ -0,0 +1,143 @@
+import os
+import shutil
+import tempfile
+import pytest
+
+import numpy as np
+import numpy.testing as npt
+
+from astropy import wcs
+from astropy.io import fits
+
+from drizzle import checkpoint
+from drizzle import drizzle
+
+TEST_DIR = os.path.abspath(os.path.dirname(__file__))
+DATA_DIR = os.path.join(TEST_DIR, 'data')
+OUTPUT_DIR = os.environ.get('DRIZZLE_TEST_OUTPUT_DIR', tempfile.mkdtemp())
+
+@pytest.yield_fixture(autouse=True, scope='module')
+def output_dir():
+    yield
+    if 'DRIZZLE_TEST_OUTPUT_DIR' not in os.environ:
+        shutil.rmtree(OUTPUT_DIR)
+
+def read_image(filename):
+    """
+    Read the image from a fits file
+    """
+    hdu = fits.open(filename)
+
+    image = hdu[1].data
+    hdu.close()
+    return image
+
+def read_wcs(filename):
+    """
+    Read the wcs of a fits file
+    """
+    hdu = fits.open(filename)
+
+    the_wcs = wcs.WCS(hdu[1].header)
+    hdu.close()
+    return the_wcs
+
+def test_resume():
+    """
+    Resuming from a checkpoint gives the same result as an unbroken run
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+    directory = os.path.join(OUTPUT_DIR, 'checkpoint_resume')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    driz = drizzle.Drizzle(outwcs=output_wcs, fillval="NaN")
+    saver = checkpoint.Checkpoint(directory)
+
+    driz.add_image(insci, inwcs)
+    saver.save(driz)
+    driz.add_image(insci, inwcs, expin=2.0)
+    saver.save(driz)
+    saver.wait()
+
+    # Images added after the last checkpoint are lost
+    driz.add_image(insci, inwcs, expin=3.0)
+
+    resumed = checkpoint.resume(directory)
+    assert(resumed.uniqid == 2)
+    assert(resumed.outexptime == 3.0)
+    assert(resumed.fillval == "NaN")
+    assert(sorted(os.listdir(directory)) ==
+           ['checkpoint.json', 'con.1.npy', 'con.2.npy', 'sci.1.npy',
+            'sci.2.npy', 'wht.1.npy', 'wht.2.npy'])
+
+    resumed.add_image(insci, inwcs, expin=3.0)
+    npt.assert_array_equal(resumed.outsci, driz.outsci)
+    npt.assert_array_equal(resumed.outwht, driz.outwht)
+    npt.assert_array_equal(resumed.outcon, driz.outcon)
+    assert(resumed.outexptime == driz.outexptime)
+
+    # Drizzling after resuming leaves the checkpoint unchanged
+    saved = checkpoint.resume(directory)
+    assert(np.count_nonzero(saved.outcon & 4) == 0)
+
+def test_save_tiles():
+    """
+    Later checkpoints rewrite only the changed tiles, whatever the caller
+    does with the changed tiles map
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+    directory = os.path.join(OUTPUT_DIR, 'checkpoint_tiles')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+
+    driz = drizzle.Drizzle(outwcs=read_wcs(output_template))
+    saver = checkpoint.Checkpoint(directory)
+    driz.add_image(insci, inwcs)
+    saver.save(driz)
+
+    for expin in (2.0, 3.0, 4.0):
+        driz.add_image(insci, inwcs, expin=expin)
+        driz.clear_dirty()
+        saver.save(driz)
+        saver.wait()
+
+        assert(0 < np.count_nonzero(saver.previous) < saver.previous.size)
+        resumed = checkpoint.resume(directory)
+        npt.assert_array_equal(resumed.outsci, driz.outsci)
+        npt.assert_array_equal(resumed.outwht, driz.outwht)
+        npt.assert_array_equal(resumed.outcon, driz.outcon)
+
+    assert(sorted(os.listdir(directory)) ==
+           ['checkpoint.json', 'con.3.npy', 'con.4.npy', 'sci.3.npy',
+            'sci.4.npy', 'wht.3.npy', 'wht.4.npy'])
+
+def test_remove_stale():
+    """
+    Only the image files of earlier checkpoints are removed
+    """
+    directory = os.path.join(OUTPUT_DIR, 'checkpoint_stale')
+    os.makedirs(directory)
+
+    names = ['sci.1.npy', 'wht.1.npy', 'con.1.npy', 'sci.2.npy',
+             'wht.2.npy', 'con.2.npy', 'user.npy', 'sci.npy', 'sci.1.npy.bak']
+    for name in names:
+        with open(os.path.join(directory, name), 'wb') as handle:
+            np.save(handle, np.zeros(1))
+
+    checkpoint.remove_stale(directory, [2])
+    assert(sorted(os.listdir(directory)) ==
+           ['con.2.npy', 'sci.1.npy.bak', 'sci.2.npy', 'sci.npy',
+            'user.npy', 'wht.2.npy'])
+
+def test_resume_missing():
+    """
+    Resuming from a directory without a checkpoint is an error
+    """
+    with pytest.raises(ValueError):
+        checkpoint.resume(OUTPUT_DIR)
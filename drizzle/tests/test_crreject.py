@@ -0,0 +1,162 @@
+import os
+import shutil
+import tempfile
+import warnings
+import pytest
+
+import numpy as np
+import numpy.testing as npt
+
+from astropy import wcs
+from astropy.io import fits
+
+from drizzle import cdrizzle
+from drizzle import docrreject
+
+TEST_DIR = os.path.abspath(os.path.dirname(__file__))
+DATA_DIR = os.path.join(TEST_DIR, 'data')
+OUTPUT_DIR = os.environ.get('DRIZZLE_TEST_OUTPUT_DIR', tempfile.mkdtemp())
+
+@pytest.yield_fixture(autouse=True, scope='module')
+def output_dir():
+    yield
+    if 'DRIZZLE_TEST_OUTPUT_DIR' not in os.environ:
+        shutil.rmtree(OUTPUT_DIR)
+
+def read_image(filename):
+    """
+    Read the image from a fits file
+    """
+    hdu = fits.open(filename)
+
+    image = hdu[1].data
+    hdu.close()
+    return image
+
+def read_wcs(filename):
+    """
+    Read the wcs of a fits file
+    """
+    hdu = fits.open(filename)
+
+    the_wcs = wcs.WCS(hdu[1].header)
+    hdu.close()
+    return the_wcs
+
+def test_crmask_derivative():
+    """
+    Test the derivative allowance keeps sharp features of the model
+    """
+    model = np.zeros((20, 20), dtype=np.float32)
+    model[:, 10:] = 1000.0
+    data = model.copy()
+    data[:, 10] = 800.0
+    data[5, 3] = 50.0
+
+    mask = np.zeros(data.shape, dtype=np.uint8)
+    cdrizzle.tcrmask(data, model, mask, readnoise=1.0, snr1=5.0, snr2=4.0,
+                     scale1=0.0, scale2=0.0)
+    assert(mask[:, 10].all())
+
+    cdrizzle.tcrmask(data, model, mask, readnoise=1.0, snr1=5.0, snr2=4.0,
+                     scale1=0.5, scale2=0.5)
+    assert(not mask[:, 10].any())
+    assert(mask[5, 3] == 1)
+    assert(np.count_nonzero(mask) == 1)
+
+def test_crreject():
+    """
+    Test cosmic rays added to each copy of an image are found
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file).astype(np.float32)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    rng = np.random.RandomState(0)
+    images = []
+    hits = []
+    for i in range(3):
+        image = insci.copy()
+        y = rng.randint(10, 1014, 50)
+        x = rng.randint(10, 1014, 50)
+        image[y, x] += 500.0
+        image[y, x + 1] += 40.0
+        images.append(image)
+        hits.append((y, x))
+
+    masks = docrreject.docrreject(images, [inwcs] * 3, output_wcs,
+                                  gain=1.0, readnoise=5.0, nthreads=2)
+
+    # Hits on steep parts of the image are allowed for by the derivative
+    for mask, (y, x) in zip(masks, hits):
+        assert(mask.dtype == np.uint8)
+        assert(np.count_nonzero(mask[y, x]) > 30)
+        assert(np.count_nonzero(mask) < 100)
+
+    # Bands of any height give the same mask, also when it is grown
+    median = docrreject.median_image(
+        [docrreject.drizzle_single(image, inwcs, None, 1.0, outwcs=output_wcs)
+         for image in images])
+    whole = docrreject.mask_image(images[0], inwcs, median, output_wcs,
+                                  readnoise=5.0, grow=1, nrows=1024)
+    banded = docrreject.mask_image(images[0], inwcs, median, output_wcs,
+                                   readnoise=5.0, grow=1, nrows=7)
+    npt.assert_array_equal(whole, banded)
+    assert(np.count_nonzero(whole[hits[0]]) > 30)
+
+def test_median_image():
+    """
+    Test the median ignores pixels with no weight and minmed takes the
+    minimum where the median is well above it
+    """
+    rng = np.random.RandomState(1)
+    data = rng.normal(100.0, 5.0, size=(5, 70, 30)).astype(np.float32)
+    weights = (rng.uniform(size=data.shape) > 0.3).astype(np.float32)
+    weights[:, 0, 0] = 0.0
+    singles = list(zip(data, weights))
+
+    median = docrreject.median_image(singles, nrows=8, nthreads=3)
+
+    with warnings.catch_warnings():
+        warnings.simplefilter("ignore", RuntimeWarning)
+        expected = np.nanmedian(np.where(weights > 0.0, data, np.nan), axis=0)
+    npt.assert_allclose(median, expected, rtol=1.0e-6)
+    assert(np.isnan(median[0, 0]))
+
+    # Cosmic rays in three of four images pull the median up
+    data = np.full((4, 10, 10), 100.0, dtype=np.float32)
+    data[1:, 4, 4] += 1000.0
+    weights = np.ones_like(data)
+    median = docrreject.median_image(list(zip(data, weights)))
+    minmed = docrreject.median_image(list(zip(data, weights)), combine='minmed',
+                                     nsigma=4.0, readnoise=5.0)
+    assert(median[4, 4] == 1100.0)
+    assert(minmed[4, 4] == 100.0)
+    npt.assert_array_equal(minmed[:4], median[:4])
+
+def test_crreject_workdir():
+    """
+    Test the median of drizzled images written to files matches the
+    median of those kept in memory
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file).astype(np.float32)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    images = [insci, insci * 1.01, insci * 0.99]
+    singles = [docrreject.drizzle_single(image, inwcs, None, 2.0,
+                                         outwcs=output_wcs)
+               for image in images]
+    outfiles = [docrreject.drizzle_single(
+        image, inwcs, None, 2.0,
+        outfile=os.path.join(OUTPUT_DIR, 'single%d.fits' % i),
+        outwcs=output_wcs) for i, image in enumerate(images)]
+
+    npt.assert_allclose(docrreject.median_products(outfiles),
+                        docrreject.median_image(singles), rtol=1.0e-6)
@@ -0,0 +1,105 @@
+import os
+import shutil
+import tempfile
+import pytest
+
+import numpy as np
+import numpy.testing as npt
+
+from astropy import wcs
+from astropy.io import fits
+
+from drizzle import cutout
+from drizzle import doblot
+from drizzle import drizzle
+from drizzle import util
+
+TEST_DIR = os.path.abspath(os.path.dirname(__file__))
+DATA_DIR = os.path.join(TEST_DIR, 'data')
+OUTPUT_DIR = os.environ.get('DRIZZLE_TEST_OUTPUT_DIR', tempfile.mkdtemp())
+
+@pytest.yield_fixture(autouse=True, scope='module')
+def output_dir():
+    yield
+    if 'DRIZZLE_TEST_OUTPUT_DIR' not in os.environ:
+        shutil.rmtree(OUTPUT_DIR)
+
+def read_wcs(filename):
+    """
+    Read the wcs of a fits file
+    """
+    hdu = fits.open(filename)
+
+    the_wcs = wcs.WCS(hdu[1].header)
+    hdu.close()
+    return the_wcs
+
+def make_mosaic(the_wcs):
+    """
+    Create a smooth image with some structure on the scale of a stamp
+    """
+    nx, ny = the_wcs.pixel_shape
+    y, x = np.indices((ny, nx), dtype=np.float64)
+    image = 100.0 + 10.0 * np.sin(x / 7.0) * np.cos(y / 11.0) + 0.01 * x
+    return image.astype(np.float32)
+
+def test_blot_cutouts():
+    """
+    Test blotting stamps together matches blotting each on its own
+    """
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+    mosaic_file = os.path.join(OUTPUT_DIR, 'mosaic_cutout.npy')
+
+    mosaic_wcs = read_wcs(output_template)
+    np.save(mosaic_file, make_mosaic(mosaic_wcs))
+    mosaic = np.load(mosaic_file, mmap_mode="r")
+
+    # Interior stamps of two sizes, one at the edge and one partly off
+    nx, ny = mosaic_wcs.pixel_shape
+    pixels = [(300.5, 400.2, (31, 31)), (700.3, 500.7, (20, 45)),
+              (800.1, 900.6, (31, 31)), (5.2, 600.4, (25, 25)),
+              (nx - 3.4, ny - 2.8, (16, 16))]
+    stamps = []
+    for x, y, shape in pixels:
+        center = mosaic_wcs.all_pix2world([[x, y]], 0)[0]
+        stamps.append(cutout.stamp_wcs(mosaic_wcs, center, shape))
+
+    for interp in ("linear", "poly5"):
+        results = cutout.blot_cutouts(mosaic, mosaic_wcs, stamps,
+                                      interp=interp)
+
+        for stamp, result in zip(stamps, results):
+            blot_wcs = stamp.deepcopy()
+            util.set_pscale(blot_wcs)
+            expected = doblot.doblot(np.array(mosaic), mosaic_wcs, blot_wcs,
+                                     1.0, interp=interp)
+            assert(result.shape == expected.shape)
+            npt.assert_allclose(result, expected, rtol=1.0e-5, atol=1.0e-4)
+
+    assert(np.count_nonzero(results[-1] == 0.0) > 0)
+
+    # The affine map is close to the full WCS over a stamp, though
+    # points at the edge of the mosaic may fall on either side of it
+    affine = cutout.blot_cutouts(mosaic, mosaic_wcs, stamps[:3], affine=True)
+    for result, expected in zip(results, affine):
+        npt.assert_allclose(result, expected, rtol=1.0e-4, atol=1.0e-2)
+
+def test_drizzle_blot_cutouts():
+    """
+    Test blotting stamps from a Drizzle object leaves its output unchanged
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    driz = drizzle.Drizzle(outwcs=read_wcs(output_template))
+    driz.outsci = make_mosaic(driz.outwcs)
+    before = driz.outsci.copy()
+
+    inwcs = read_wcs(input_file)
+    stamp = inwcs.slice((slice(200, 240), slice(300, 330)))
+    stamp.pixel_shape = (30, 40)
+
+    result, = driz.blot_cutouts([stamp], interp="poly3")
+    assert(result.shape == (40, 30))
+    assert(np.all(result > 50.0))
+    npt.assert_array_equal(driz.outsci, before)
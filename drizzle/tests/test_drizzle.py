@@ -3,6 +3,7 @@ import math
 import os
 import shutil
 import tempfile
+import tracemalloc
 import pytest
 
 import numpy as np
@@ -12,7 +13,11 @@ import numpy.testing as npt
 from astropy import wcs
 from astropy.io import fits
 
+from drizzle import calc_pixmap
+from drizzle import cdrizzle
 from drizzle import drizzle
+from drizzle import doblot
+from drizzle import dodrizzle
 
 TEST_DIR = os.path.abspath(os.path.dirname(__file__))
 DATA_DIR = os.path.join(TEST_DIR, 'data')
@@ -420,6 +425,65 @@ def test_point_with_grid():
         assert(med_diff < 1.0e-6)
         assert(max_diff < 1.0e-5)
 
+def test_fill_after_add():
+    """
+    Test the fill value is applied once after adding images
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    insci = make_grid_image(insci, 64, 100.0)
+    inwht = np.ones(insci.shape,dtype=insci.dtype)
+    inwht[:, :inwht.shape[1] // 2] = 0.0
+    output_wcs = read_wcs(output_template)
+
+    driz = drizzle.Drizzle(outwcs=output_wcs, wt_scl="", fillval="NaN")
+    driz.add_image(insci, inwcs, inwht=inwht)
+    driz.add_image(insci, inwcs, inwht=inwht[:, ::-1].copy())
+
+    # Filling after each image, as the C code does, gives the same result
+    outsci = np.zeros_like(driz.outwht)
+    outwht = np.zeros_like(driz.outwht)
+    outcon = np.zeros_like(driz.outcon)
+    for uniqid, weights in enumerate((inwht, inwht[:, ::-1].copy()), 1):
+        dodrizzle.dodrizzle(insci, inwcs, weights, output_wcs,
+                            outsci, outwht, outcon, 1.0, "cps", 1.0,
+                            wcslin_pscale=inwcs.pscale, uniqid=uniqid,
+                            fillval="NaN")
+
+    assert(np.isnan(driz.outsci).any())
+    npt.assert_array_equal(driz.outsci, outsci)
+    npt.assert_array_equal(driz.outwht, outwht)
+
+def test_blot_dirty_tiles():
+    """
+    Test reblotting only the changed tiles matches a full blot
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    driz = drizzle.Drizzle(outwcs=output_wcs, wt_scl="")
+    driz.add_image(make_grid_image(insci, 64, 100.0), inwcs)
+    blotted = doblot.doblot(driz.outsci, driz.outwcs, inwcs, 1.0)
+    driz.clear_dirty()
+
+    inwht = np.zeros(insci.shape, dtype=insci.dtype)
+    inwht[450:550, 150:250] = 1.0
+    driz.add_image(make_point_image(insci, (500, 200), 40.0), inwcs,
+                   inwht=inwht)
+    assert(0 < np.count_nonzero(driz.outdirty) < driz.outdirty.size // 4)
+
+    doblot.doblot(driz.outsci, driz.outwcs, inwcs, 1.0,
+                  blotted=blotted, dirty=driz.outdirty)
+    expected = doblot.doblot(driz.outsci, driz.outwcs, inwcs, 1.0)
+    npt.assert_array_equal(blotted, expected)
+
 def test_blot_with_point():
     """
     Test do_blot with point image
@@ -543,6 +607,283 @@ def test_blot_with_lan5():
         assert(med_diff < 1.0e-6)
         assert(max_diff < 1.0e-5)
 
+def test_blot_poly_ramp():
+    """
+    Test poly3 and poly5 blot reproduce a linear ramp inside and at the edges
+    """
+    y, x = np.indices((100, 120), dtype=np.float64)
+    source = (0.5 * x + 0.25 * y + 10.0).astype(np.float32)
+
+    # Stretched and shifted so output pixels fall in every part of each cell
+    pixmap = np.dstack([0.97 * x + 0.3, 0.93 * y + 0.6])
+    expected = 0.5 * pixmap[..., 0] + 0.25 * pixmap[..., 1] + 10.0
+
+    for interp in ("poly3", "poly5"):
+        blotted = np.zeros(source.shape, dtype=np.float32)
+        cdrizzle.tblot(source, pixmap, blotted, scale=1.0, kscale=1.0,
+                       interp=interp, exptime=1.0, misval=0.0, sinscl=1.0)
+        npt.assert_allclose(blotted, expected, rtol=1.0e-5)
+
+def test_blot_simple_edges():
+    """
+    Test nearest and bilinear blot stay on the image at its last row and column
+    """
+    y, x = np.indices((40, 50), dtype=np.float64)
+    source = (0.5 * x + 0.25 * y + 10.0).astype(np.float32)
+
+    # Points in the last half pixel and the last cell of the input
+    pixmap = np.dstack([0.98 * x + 0.99, 0.975 * y + 0.99])
+    inside = (pixmap[..., 0] < 50) & (pixmap[..., 1] < 40)
+
+    blotted = np.zeros(source.shape, dtype=np.float32)
+    cdrizzle.tblot(source, pixmap, blotted, interp="nearest", misval=-1.0)
+    nx = np.minimum(np.floor(pixmap[..., 0] + 0.5), 49)
+    ny = np.minimum(np.floor(pixmap[..., 1] + 0.5), 39)
+    expected = np.where(inside, 0.5 * nx + 0.25 * ny + 10.0, -1.0)
+    npt.assert_array_equal(blotted, expected)
+
+    # Reflecting across the edges keeps the ramp linear
+    blotted = np.zeros(source.shape, dtype=np.float32)
+    cdrizzle.tblot(source, pixmap, blotted, interp="linear", misval=-1.0)
+    expected = 0.5 * pixmap[..., 0] + 0.25 * pixmap[..., 1] + 10.0
+    expected = np.where(inside, expected, -1.0)
+    npt.assert_allclose(blotted, expected, rtol=1.0e-5)
+
+def test_blot_stack():
+    """
+    Test blotting a stack matches blotting each of its planes
+    """
+    rng = np.random.RandomState(0)
+    stack = rng.normal(size=(3, 40, 50)).astype(np.float32)
+
+    y, x = np.indices((45, 55), dtype=np.float64)
+    pixmap = np.dstack([0.93 * x - 1.2, 0.91 * y - 0.7])
+
+    for interp in ("nearest", "linear", "poly5", "lan3"):
+        blotted = np.zeros((3, 45, 55), dtype=np.float32)
+        cdrizzle.tblot(stack, pixmap, blotted, interp=interp, misval=-1.0)
+
+        for source, result in zip(stack, blotted):
+            expected = np.zeros((45, 55), dtype=np.float32)
+            cdrizzle.tblot(source, pixmap, expected, interp=interp, misval=-1.0)
+            npt.assert_array_equal(result, expected)
+
+    with pytest.raises(Exception):
+        cdrizzle.tblot(stack, pixmap, np.zeros((2, 45, 55), dtype=np.float32))
+
+def test_accumulate_sum():
+    """
+    Test accumulating weighted sums gives the weighted mean once read,
+    and images may be added again after reading it
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    inwht = np.ones(insci.shape, dtype=np.float32)
+    inwht[100:200, 300:400] = 0.0
+
+    results = {}
+    for accumulate in ("mean", "sum"):
+        driz = drizzle.Drizzle(outwcs=output_wcs, fillval="0",
+                               accumulate=accumulate)
+        driz.add_image(insci, inwcs, inwht=inwht, expin=2.0)
+        driz.add_image(insci * 1.5, inwcs, inwht=2.0 * inwht, expin=1.0)
+        first = driz.outsci.copy()
+        driz.add_image(insci * 0.5, inwcs, expin=1.0)
+        results[accumulate] = (first, driz.outsci.copy(), driz.outwht.copy())
+
+    for mean, summed in zip(results["mean"], results["sum"]):
+        npt.assert_allclose(summed, mean, rtol=1.0e-5, atol=1.0e-5)
+
+    # Reading the output leaves the accumulated sum unchanged
+    accumulator = driz._outsci.copy()
+    assert(driz.outsci is driz.outsci)
+    npt.assert_array_equal(driz._outsci, accumulator)
+
+    driz.finalize()
+    npt.assert_allclose(driz.outsci, results["sum"][1], rtol=1.0e-6)
+
+    with pytest.raises(ValueError):
+        drizzle.Drizzle(outwcs=output_wcs, accumulate="median")
+
+def test_dq_bits():
+    """
+    Test data quality flags give the same result as zeroing the weight
+    of the flagged pixels
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    rng = np.random.RandomState(0)
+    dq = rng.choice([0, 1, 4, 16, 4096], size=insci.shape,
+                    p=[0.9, 0.025, 0.025, 0.025, 0.025]).astype(np.uint16)
+    dq[:, :40] = 16
+    dq[500, :] = 16
+    dq[600, :] = 32768
+    inwht = rng.uniform(0.5, 1.5, size=insci.shape).astype(np.float32)
+
+    # Flags 1 and 4 are allowed, 16 and 4096 reject a pixel
+    masked = np.where((dq & ~np.uint16(5)) != 0, 0.0, inwht).astype(np.float32)
+
+    for kernel in ("square", "point", "gaussian", "turbo"):
+        expected = drizzle.Drizzle(outwcs=output_wcs, kernel=kernel)
+        expected.add_image(insci, inwcs, inwht=masked)
+
+        # Signed flags, as read from FITS without BZERO, are the same bits
+        for flags in (dq, dq.astype(np.uint32), dq.view(np.int16),
+                      dq.view(np.int16).astype('>i2'), dq.astype(np.int32)):
+            driz = drizzle.Drizzle(outwcs=output_wcs, kernel=kernel)
+            driz.add_image(insci, inwcs, inwht=inwht, dq=flags, bits=5)
+
+            npt.assert_array_equal(driz.outsci, expected.outsci)
+            npt.assert_array_equal(driz.outwht, expected.outwht)
+            npt.assert_array_equal(driz.outcon, expected.outcon)
+
+    driz = drizzle.Drizzle(outwcs=output_wcs)
+    with pytest.raises(Exception, match="8, 16 or 32 bit integers"):
+        driz.add_image(insci, inwcs, dq=dq.astype(np.int64), bits=5)
+
+def test_ivm_weights():
+    """
+    Test inverse variance weighting matches weights computed beforehand
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    rng = np.random.RandomState(0)
+    flat = rng.uniform(0.9, 1.1, size=insci.shape).astype(np.float32)
+    sky = rng.uniform(80.0, 120.0, size=insci.shape).astype(np.float32)
+    inwht = (rng.uniform(size=insci.shape) > 0.05).astype(np.float32)
+    expin, dark, readnoise = 400.0, 5.0, 4.5
+
+    for sky_model in (sky, 100.0):
+        ivm = (expin * flat) ** 2 / (sky_model * flat + dark + readnoise ** 2)
+        expected = drizzle.Drizzle(outwcs=output_wcs, wt_scl="")
+        expected.add_image(insci, inwcs, inwht=(inwht * ivm).astype(np.float32),
+                           expin=expin)
+
+        driz = drizzle.Drizzle(outwcs=output_wcs, wt_scl="ivm")
+        driz.add_image(insci, inwcs, inwht=inwht, expin=expin, sky=sky_model,
+                       flat=flat, dark=dark, readnoise=readnoise)
+
+        npt.assert_allclose(driz.outsci, expected.outsci, rtol=1.0e-5, atol=1.0e-6)
+        npt.assert_allclose(driz.outwht, expected.outwht, rtol=1.0e-5)
+        npt.assert_array_equal(driz.outcon, expected.outcon)
+
+    # Without a noise model every weight would be infinite
+    with pytest.raises(ValueError):
+        driz.add_image(insci, inwcs, expin=expin)
+
+def test_add_image_no_copy():
+    """
+    Test a float32 image in counts without weights is drizzled without
+    allocating, or changing, any image sized array
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file).astype(np.float32)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+    original = insci.copy()
+
+    expected = drizzle.Drizzle(outwcs=output_wcs)
+    expected.add_image(insci / np.float32(2.0), inwcs,
+                       inwht=np.ones(insci.shape, dtype=np.float32), expin=2.0)
+
+    driz = drizzle.Drizzle(outwcs=output_wcs)
+    pixmap = calc_pixmap.calc_pixmap(inwcs, output_wcs)
+
+    tracemalloc.start()
+    try:
+        driz.add_image(insci, inwcs, expin=2.0, in_units="counts",
+                       pixmap=pixmap)
+        peak = tracemalloc.get_traced_memory()[1]
+    finally:
+        tracemalloc.stop()
+
+    assert(peak < insci.nbytes // 10)
+    npt.assert_array_equal(insci, original)
+    npt.assert_allclose(driz.outsci, expected.outsci, rtol=1.0e-6, atol=1.0e-6)
+    npt.assert_array_equal(driz.outwht, expected.outwht)
+    npt.assert_array_equal(driz.outcon, expected.outcon)
+
+def test_scalar_weights():
+    """
+    Test a single weight, or none, gives the same result as an array
+    of weights with that value
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    for kernel in ("square", "point", "gaussian", "turbo", "lanczos3"):
+        for weight in (None, 2.5):
+            value = 1.0 if weight is None else weight
+            expected = drizzle.Drizzle(outwcs=output_wcs, kernel=kernel)
+            expected.add_image(insci, inwcs, expin=2.0,
+                               inwht=np.full(insci.shape, value, np.float32))
+
+            driz = drizzle.Drizzle(outwcs=output_wcs, kernel=kernel)
+            driz.add_image(insci, inwcs, inwht=weight, expin=2.0)
+
+            npt.assert_array_equal(driz.outsci, expected.outsci)
+            npt.assert_array_equal(driz.outwht, expected.outwht)
+            npt.assert_array_equal(driz.outcon, expected.outcon)
+
+    with pytest.raises(ValueError):
+        driz.add_image(insci, inwcs, inwht=0.0)
+
+def test_large_output():
+    """
+    Test drizzling onto an output with more than 2^31 pixels, held in
+    sparse memory mapped files so only the pixels written use space
+    """
+    shape = (50000, 43000)
+    assert(shape[0] * shape[1] > 2 ** 31)
+
+    outsci = np.memmap(os.path.join(OUTPUT_DIR, 'large_sci.dat'),
+                       dtype=np.float32, mode='w+', shape=shape)
+    outwht = np.memmap(os.path.join(OUTPUT_DIR, 'large_wht.dat'),
+                       dtype=np.float32, mode='w+', shape=shape)
+    outcon = np.memmap(os.path.join(OUTPUT_DIR, 'large_con.dat'),
+                       dtype=np.int32, mode='w+', shape=shape)
+
+    # The input lands in the last corner, with its last columns off the edge
+    insci = np.arange(400, dtype=np.float32).reshape(20, 20) + 1.0
+    inwht = np.ones(insci.shape, dtype=np.float32)
+    y, x = np.indices(insci.shape, dtype=np.float64)
+    pixmap = np.dstack([x + 42985.0, y + 49975.0])
+
+    _vers, nmiss, nskip = cdrizzle.tdriz(
+        insci, inwht, pixmap, outsci, outwht, outcon, uniqid=1,
+        xmin=0, xmax=20, ymin=0, ymax=20, kernel='point')
+
+    window = (slice(49970, 50000), slice(42980, 43000))
+    expected = np.zeros((30, 20), dtype=np.float32)
+    expected[5:25, 5:] = insci[:, :15]
+    npt.assert_array_equal(outsci[window], expected)
+    npt.assert_array_equal(outwht[window], expected > 0.0)
+    npt.assert_array_equal(outcon[window], expected > 0.0)
+    assert(nmiss == 100)
+
+    del outsci, outwht, outcon
+
 if __name__ == "__main__":
     """
     Run tests from command line
@@ -12,8 +12,10 @@ import numpy.testing as npt
 from astropy import wcs
 from astropy.io import fits
 
+from drizzle import cdrizzle
 from drizzle import drizzle
 from drizzle import util
+from drizzle import writer
 
 TEST_DIR = os.path.abspath(os.path.dirname(__file__))
 DATA_DIR = os.path.join(TEST_DIR, 'data')
@@ -148,6 +150,248 @@ def test_add_file():
     diff_image = np.absolute(output_image - test_image)
     assert(np.amax(diff_image) == 0.0)
 
+def test_update_file():
+    """
+    Rewrite only the changed tiles of an existing output file
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_file = os.path.join(OUTPUT_DIR, 'output_update_file.fits')
+    test_file = os.path.join(OUTPUT_DIR, 'output_update_full.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    image = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    inwht = np.zeros(image.shape, dtype=image.dtype)
+    inwht[:100, :100] = 1.0
+
+    driz = drizzle.Drizzle(infile=output_template)
+    driz.write(output_file)
+    driz.clear_dirty()
+
+    driz.add_image(image, inwcs, inwht=inwht)
+    assert(0 < np.count_nonzero(driz.outdirty) < driz.outdirty.size)
+
+    # Mark a pixel of a clean tile, which the update must leave alone
+    tile = cdrizzle.DRIZ_TILE_SIZE
+    jtile, itile = np.argwhere(driz.outdirty == 0)[0]
+    marked = (jtile * tile, itile * tile)
+    with fits.open(output_file, mode='update') as handle:
+        handle['WHT'].data[marked] = -1.0
+
+    assert(driz.update_file(output_file, "cps", None))
+    driz.write(test_file)
+
+    for extn in ('SCI', 'WHT', 'CTX'):
+        output_image = fits.getdata(output_file, extn)
+        test_image = fits.getdata(test_file, extn)
+        if extn == 'WHT':
+            assert(output_image[marked] == -1.0)
+            test_image = np.array(test_image)
+            test_image[marked] = -1.0
+        npt.assert_array_equal(output_image, test_image)
+
+    header = read_header(output_file)
+    assert(header['NDRIZIM'] == driz.uniqid)
+    assert(header['EXPTIME'] == driz.outexptime)
+
+def test_write_counts():
+    """
+    Write the output in counts twice without changing the output image
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_file = os.path.join(OUTPUT_DIR, 'output_write_counts.fits')
+    test_file = os.path.join(OUTPUT_DIR, 'output_write_counts_again.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    driz = drizzle.Drizzle(outwcs=read_wcs(output_template))
+    driz.add_image(read_image(input_file), read_wcs(input_file), expin=2.0)
+    outsci = driz.outsci.copy()
+
+    driz.write(output_file, out_units="counts")
+    driz.write(test_file, out_units="counts")
+    npt.assert_array_equal(driz.outsci, outsci)
+
+    with open(output_file, "rb") as handle, open(test_file, "rb") as test:
+        assert(handle.read() == test.read())
+
+    with fits.open(output_file) as handle:
+        handle.verify("exception")
+        assert(handle[0].header['DRIZEXPT'] == 2.0)
+        npt.assert_array_equal(handle['SCI'].data, outsci * np.float32(2.0))
+        npt.assert_array_equal(handle['WHT'].data, driz.outwht)
+        npt.assert_array_equal(handle['CTX'].data, driz.outcon)
+
+    # Rereading the file converts it back to count rates
+    again = drizzle.Drizzle(infile=output_file)
+    npt.assert_allclose(again.outsci, outsci, rtol=1.0e-6)
+
+def test_write_chunks():
+    """
+    Write images in chunks smaller than a row and larger than the image
+    """
+    output_file = os.path.join(OUTPUT_DIR, 'output_write_chunks.fits')
+    image = np.arange(5 * 7 * 11, dtype=np.int32).reshape(5, 7, 11)[::2, :, 1:]
+    data = np.linspace(0.0, 1.0, 7 * 11, dtype=np.float32).reshape(7, 11).T
+
+    for chunk_size, nthreads in ((1, 1), (100, 3), (10000, 3)):
+        extensions = [(fits.Header([('EXTNAME', 'CTX')]), image, None),
+                      (fits.Header([('EXTNAME', 'SCI')]), data, 3.0)]
+        writer.write_product(output_file, fits.Header(), extensions,
+                             chunk_size=chunk_size, nthreads=nthreads)
+
+        with fits.open(output_file) as handle:
+            handle.verify("exception")
+            npt.assert_array_equal(handle['CTX'].data, image)
+            npt.assert_array_equal(handle['SCI'].data, data * np.float32(3.0))
+
+def test_write_sum():
+    """
+    A weighted sum is written divided by the weights without normalizing
+    a copy of the output first
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+    output_file = os.path.join(OUTPUT_DIR, 'output_write_sum.fits')
+    update_file = os.path.join(OUTPUT_DIR, 'output_write_sum_update.fits')
+
+    results = {}
+    for accumulate in ("mean", "sum"):
+        driz = drizzle.Drizzle(outwcs=read_wcs(output_template), fillval="NaN",
+                               accumulate=accumulate)
+        driz.add_image(read_image(input_file), read_wcs(input_file))
+        driz.write(update_file)
+        driz.clear_dirty()
+        driz.add_image(read_image(input_file), read_wcs(input_file), expin=2.0)
+        driz.write(output_file, out_units="counts")
+        assert(driz.update_file(update_file, "cps", None))
+        if accumulate == "sum":
+            assert(driz._normalized is None)
+        results[accumulate] = (fits.getdata(output_file, 'SCI'),
+                               fits.getdata(update_file, 'SCI'))
+
+    for mean, summed in zip(results["mean"], results["sum"]):
+        npt.assert_allclose(summed, mean, rtol=1.0e-5, atol=1.0e-5)
+        assert(np.isnan(summed).any())
+
+def test_write_compressed():
+    """
+    Write tile compressed output and read it back
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_file = os.path.join(OUTPUT_DIR, 'output_write_compressed.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    driz = drizzle.Drizzle(outwcs=read_wcs(output_template))
+    driz.add_image(read_image(input_file), read_wcs(input_file), expin=2.0)
+    driz.write(output_file, out_units="counts", compress="GZIP_1", nthreads=3)
+
+    with fits.open(output_file) as handle:
+        handle.verify("exception")
+        assert(isinstance(handle['SCI'], fits.CompImageHDU))
+        assert(handle[0].header['NDRIZIM'] == driz.uniqid)
+        npt.assert_array_equal(handle['WHT'].data, driz.outwht)
+        npt.assert_array_equal(handle['CTX'].data, driz.outcon)
+
+    again = drizzle.Drizzle(infile=output_file)
+    npt.assert_allclose(again.outsci, driz.outsci, rtol=1.0e-6)
+    npt.assert_array_equal(again.outwht, driz.outwht)
+    npt.assert_array_equal(again.outcon, driz.outcon)
+
+def test_write_compact():
+    """
+    Write compact weight and context images and read them back
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_file = os.path.join(OUTPUT_DIR, 'output_write_compact.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    driz = drizzle.Drizzle(outwcs=read_wcs(output_template))
+    driz.add_image(read_image(input_file), read_wcs(input_file))
+    driz.add_image(read_image(input_file), read_wcs(input_file), expin=2.0)
+    driz.outcon[0, 0, 0] = 7
+    driz.outcon = np.concatenate([driz.outcon, driz.outcon[::-1] * 3])
+
+    step = driz.outwht.max() / 65535.0
+    for wht_format, rtol, atol in (("float16", 1.0e-3, 1.0e-6),
+                                   ("uint16", 0.0, step)):
+        driz.write(output_file, wht_format=wht_format, ctx_format="dictionary")
+
+        with fits.open(output_file) as handle:
+            handle.verify("exception")
+            assert(handle['WHT'].header['BITPIX'] == 16)
+            assert(handle['CTX'].data.dtype == np.uint16)
+
+        again = drizzle.Drizzle(infile=output_file)
+        npt.assert_array_equal(again.outsci, driz.outsci)
+        npt.assert_array_equal(again.outcon, driz.outcon)
+        npt.assert_allclose(again.outwht, driz.outwht, rtol=rtol, atol=atol)
+
+    with fits.open(output_file) as handle:
+        assert('DRIZWHTF' not in handle['WHT'].header)
+
+    driz.write(output_file, wht_format="float16")
+    with fits.open(output_file) as handle:
+        assert(handle['WHT'].header['DRIZWHTF'] == 'float16')
+
+    # Weights beyond the range of half precision are refused
+    driz.outwht *= 1.0e5 / driz.outwht.max()
+    with pytest.raises(ValueError):
+        driz.write(output_file, wht_format="float16")
+
+def test_add_files():
+    """
+    Add a list of files read ahead in the background
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits[1]')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    serial = drizzle.Drizzle(infile=output_template)
+    for i in range(3):
+        serial.add_fits_file(input_file)
+
+    for prefetch in (0, 2):
+        driz = drizzle.Drizzle(infile=output_template)
+        driz.add_fits_files([input_file] * 3, prefetch=prefetch)
+
+        assert(driz.uniqid == serial.uniqid)
+        npt.assert_array_equal(driz.outsci, serial.outsci)
+        npt.assert_array_equal(driz.outwht, serial.outwht)
+        npt.assert_array_equal(driz.outcon, serial.outcon)
+
+def test_add_compressed_file():
+    """
+    Add a tile compressed image decoded and drizzled in bands
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    compressed_file = os.path.join(OUTPUT_DIR, 'input_compressed.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    with fits.open(input_file) as handle:
+        hdu = fits.CompImageHDU(data=handle[1].data, header=handle[1].header,
+                                compression_type='RICE_1')
+        fits.HDUList([fits.PrimaryHDU(header=handle[0].header), hdu]).writeto(
+            compressed_file, overwrite=True)
+
+    with fits.open(compressed_file) as handle:
+        image = handle[1].data.copy()
+        inwcs = wcs.WCS(handle[1].header)
+
+    serial = drizzle.Drizzle(infile=output_template)
+    serial.add_image(image, inwcs)
+
+    driz = drizzle.Drizzle(infile=output_template)
+    driz.add_fits_file(compressed_file, nthreads=3)
+
+    assert(drizzle.is_compressed(compressed_file))
+    npt.assert_array_equal(driz.outsci, serial.outsci)
+    npt.assert_array_equal(driz.outwht, serial.outwht)
+    npt.assert_array_equal(driz.outcon, serial.outcon)
+
+    listed = drizzle.Drizzle(infile=output_template)
+    listed.add_fits_files([compressed_file])
+    npt.assert_array_equal(listed.outsci, serial.outsci)
+    npt.assert_array_equal(listed.outwht, serial.outwht)
+
 def test_blot_file():
     """
     Blot an image read from a file
@@ -0,0 +1,131 @@
+import os
+import shutil
+import tempfile
+import pytest
+
+import numpy as np
+import numpy.testing as npt
+
+from astropy import wcs
+from astropy.io import fits
+
+from drizzle import cdrizzle
+from drizzle import drizzle
+from drizzle import merge
+
+TEST_DIR = os.path.abspath(os.path.dirname(__file__))
+DATA_DIR = os.path.join(TEST_DIR, 'data')
+OUTPUT_DIR = os.environ.get('DRIZZLE_TEST_OUTPUT_DIR', tempfile.mkdtemp())
+
+@pytest.yield_fixture(autouse=True, scope='module')
+def output_dir():
+    yield
+    if 'DRIZZLE_TEST_OUTPUT_DIR' not in os.environ:
+        shutil.rmtree(OUTPUT_DIR)
+
+def read_image(filename):
+    """
+    Read the image from a fits file
+    """
+    hdu = fits.open(filename)
+
+    image = hdu[1].data
+    hdu.close()
+    return image
+
+def read_wcs(filename):
+    """
+    Read the wcs of a fits file
+    """
+    hdu = fits.open(filename)
+
+    the_wcs = wcs.WCS(hdu[1].header)
+    hdu.close()
+    return the_wcs
+
+def test_merge_context():
+    """
+    Context bits are shifted across plane boundaries
+    """
+    context = np.array([[[1, -1]], [[2, 0]]], dtype=np.int32)
+    output = np.zeros((3, 1, 2), dtype=np.int32)
+
+    cdrizzle.tmerge_context(context, output, offset=31)
+
+    output = output.view(np.uint32)
+    npt.assert_array_equal(output[:, 0, 0], [1 << 31, 0, 1])
+    npt.assert_array_equal(output[:, 0, 1], [1 << 31, 0x7fffffff, 0])
+
+def test_merge_products():
+    """
+    Merging the products of two runs matches a single run over all images
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+    output_file = os.path.join(OUTPUT_DIR, 'output_merge.fits')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    exposures = [1.0, 2.0, 3.0]
+    inwht = np.ones(insci.shape, dtype=insci.dtype)
+    inwht[:, :200] = 0.0
+
+    whole = drizzle.Drizzle(outwcs=output_wcs, fillval="NaN")
+    for expin in exposures:
+        whole.add_image(insci, inwcs, inwht=inwht, expin=expin)
+
+    partial_files = []
+    for i, shard in enumerate((exposures[:2], exposures[2:])):
+        partial = drizzle.Drizzle(outwcs=output_wcs, fillval="NaN")
+        for expin in shard:
+            partial.add_image(insci, inwcs, inwht=inwht, expin=expin)
+
+        partial_file = os.path.join(OUTPUT_DIR, 'output_partial%d.fits' % i)
+        partial.write(partial_file, out_units="counts")
+        partial_files.append(partial_file)
+
+    merge.main([output_file] + partial_files + ['--rows', '50', '--threads', '3'])
+
+    with fits.open(output_file) as handle:
+        assert(handle[0].header['NDRIZIM'] == 3)
+        assert(handle[0].header['EXPTIME'] == 6.0)
+        npt.assert_allclose(handle['SCI'].data, whole.outsci, rtol=1.0e-5)
+        npt.assert_allclose(handle['WHT'].data, whole.outwht, rtol=1.0e-5)
+        npt.assert_array_equal(handle['CTX'].data, whole.outcon)
+        assert(np.isnan(handle['SCI'].data).any())
+
+def test_merge_compact_products():
+    """
+    Products with compact weight and context images are decoded when merged
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+    output_file = os.path.join(OUTPUT_DIR, 'output_merge_compact.fits')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    whole = drizzle.Drizzle(outwcs=output_wcs)
+    partial_files = []
+    for i, expin in enumerate((1.0, 2.0)):
+        whole.add_image(insci, inwcs, expin=expin)
+
+        partial = drizzle.Drizzle(outwcs=output_wcs)
+        partial.add_image(insci, inwcs, expin=expin)
+        partial_file = os.path.join(OUTPUT_DIR, 'output_compact%d.fits' % i)
+        partial.write(partial_file, wht_format="float16", ctx_format="dictionary")
+        partial_files.append(partial_file)
+
+    merge.merge_products(partial_files, output_file, nrows=50)
+
+    with fits.open(output_file) as handle:
+        assert(handle[0].header['DRIZWHTF'] == 'float32')
+        assert(handle[0].header['DRIZCTXF'] == 'int32')
+
+    merged = drizzle.Drizzle(infile=output_file)
+    npt.assert_allclose(merged.outsci, whole.outsci, rtol=1.0e-3, atol=1.0e-5)
+    npt.assert_allclose(merged.outwht, whole.outwht, rtol=1.0e-3, atol=1.0e-6)
+    npt.assert_array_equal(merged.outcon, whole.outcon)
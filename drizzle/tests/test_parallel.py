@@ -0,0 +1,120 @@
+import os
+import signal
+from multiprocessing import shared_memory
+
+import pytest
+
+import numpy as np
+import numpy.testing as npt
+
+from astropy import wcs
+from astropy.io import fits
+
+from drizzle import drizzle
+from drizzle import parallel
+
+TEST_DIR = os.path.abspath(os.path.dirname(__file__))
+DATA_DIR = os.path.join(TEST_DIR, 'data')
+
+def read_image(filename):
+    """
+    Read the image from a fits file
+    """
+    hdu = fits.open(filename)
+
+    image = hdu[1].data
+    hdu.close()
+    return image
+
+def read_wcs(filename):
+    """
+    Read the wcs of a fits file
+    """
+    hdu = fits.open(filename)
+
+    the_wcs = wcs.WCS(hdu[1].header)
+    hdu.close()
+    return the_wcs
+
+def test_parallel_drizzle():
+    """
+    Drizzling in several processes matches drizzling in one
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    insci = read_image(input_file)
+    inwcs = read_wcs(input_file)
+    output_wcs = read_wcs(output_template)
+
+    exposures = [1.0, 2.0, 3.0, 4.0]
+    serial = drizzle.Drizzle(outwcs=output_wcs, fillval="NaN")
+    for expin in exposures:
+        serial.add_image(insci, inwcs, expin=expin)
+
+    driz = parallel.ParallelDrizzle(output_wcs, nprocs=2, fillval="NaN")
+    for expin in exposures:
+        driz.add_image(insci, inwcs, expin=expin)
+    driz = driz.finish()
+
+    assert(sorted(driz.order) == list(range(len(exposures))))
+    assert(driz.uniqid == serial.uniqid)
+    assert(driz.outexptime == serial.outexptime)
+    npt.assert_allclose(driz.outsci, serial.outsci, rtol=1.0e-5)
+    npt.assert_allclose(driz.outwht, serial.outwht, rtol=1.0e-5)
+
+    # Bit j of the merged context is bit order[j] of the serial context
+    for j, number in enumerate(driz.order):
+        npt.assert_array_equal((driz.outcon[0] >> j) & 1,
+                               (serial.outcon[0] >> number) & 1)
+
+def test_parallel_synthetic():
+    """
+    The benchmark stack drizzles with any number of processes
+    """
+    timings = parallel.benchmark(nimage=3, shape=(64, 64), nprocs=2)
+    assert([workers for workers, seconds in timings] == [1, 2])
+
+def test_parallel_release():
+    """
+    The shared memory is unlinked and the workers stopped when the caller
+    fails inside a with block or abandons the object before finish
+    """
+    output_wcs = parallel.synthetic_wcs((64, 64), 0.0, 0.0, 0.0)
+
+    with pytest.raises(ValueError):
+        with parallel.ParallelDrizzle(output_wcs, nprocs=2) as driz:
+            names = [block.name for block in driz.blocks.values()]
+            workers = list(driz.workers)
+            raise ValueError("caller failed")
+
+    assert(driz.blocks == {} and driz.workers == [])
+    driz.close()
+
+    driz = parallel.ParallelDrizzle(output_wcs, nprocs=2)
+    names += [block.name for block in driz.blocks.values()]
+    workers += driz.workers
+    del driz
+
+    assert(not any(worker.is_alive() for worker in workers))
+    for name in names:
+        with pytest.raises(FileNotFoundError):
+            shared_memory.SharedMemory(name=name)
+
+@pytest.mark.skipif(not hasattr(signal, "SIGKILL"), reason="needs SIGKILL")
+def test_parallel_worker_killed():
+    """
+    A worker killed while drizzling is reported instead of waited for
+    """
+    input_file = os.path.join(DATA_DIR, 'j8bt06nyq_flt.fits')
+    output_template = os.path.join(DATA_DIR, 'reference_square_point.fits')
+
+    driz = parallel.ParallelDrizzle(read_wcs(output_template), nprocs=2)
+    driz.add_image(read_image(input_file), read_wcs(input_file))
+
+    worker = driz.workers[1]
+    os.kill(worker.pid, signal.SIGKILL)
+    worker.join()
+
+    with pytest.raises(RuntimeError, match="exited with code"):
+        driz.finish()
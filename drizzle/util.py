@@ -96,9 +96,10 @@ def get_extn(fimg, extn=''):
 
         # Set up default to point to PRIMARY extension.
         _extn = fimg[0]
-        # then look for first extension with data.
+        # then look for first extension with data, without reading it,
+        # as reading a compressed image decompresses all of it.
         for _e in fimg:
-            if _e.data is not None:
+            if _e.size > 0:
                 _extn = _e
                 break
 
@@ -225,6 +226,34 @@ def parse_filename(filename):
 
     return _fname, _extn
 
+def parse_fillval(fillval):
+    """
+    Convert a drizzle fill value to a number, following the same
+    rules as the C code.
+
+    Parameters
+    ----------
+
+    fillval : str or number
+        The fill value. A blank string or INDEF means no fill.
+
+    Returns
+    -------
+
+    The fill value as a float, or None if output pixels are not filled
+    """
+    if fillval is None:
+        return None
+
+    fillval = str(fillval).strip()
+    if fillval == "" or fillval.upper() == "INDEF":
+        return None
+
+    try:
+        return float(fillval)
+    except ValueError:
+        raise ValueError("Illegal fill value: %s" % fillval)
+
 def set_pscale(the_wcs):
     """
     Calculates the plate scale from cdelt and the pc  matrix and adds
@@ -0,0 +1,429 @@
+"""
+Write drizzle products without copying their images.
+
+Astropy converts each image of a FITS file to big endian as a whole
+before writing it, which for a large mosaic costs a full size copy of
+every extension, and writes the extensions one after another. This
+module lays out the file from the headers first, then converts the
+images a chunk of rows at a time and writes the chunks at their offsets
+from several threads, applying any change of units on the way, so the
+images in memory are never modified or copied.
+"""
+from __future__ import division, print_function, unicode_literals, absolute_import
+
+import concurrent.futures
+import os
+import shutil
+import tempfile
+import threading
+
+import numpy as np
+from astropy.io import fits
+
+# Bytes of image data converted and written at a time
+CHUNK_SIZE = 1 << 22
+
+BITPIX = {
+    np.dtype(np.uint8): 8,
+    np.dtype(np.int16): 16,
+    np.dtype(np.int32): 32,
+    np.dtype(np.int64): 64,
+    np.dtype(np.float32): -32,
+    np.dtype(np.float64): -64
+    }
+
+# Serializes seek and write where the platform has no pwrite
+_seek_lock = threading.Lock()
+
+
+def image_header(image, header=None):
+    """
+    Return the header of an image extension holding an image, with the
+    cards of header appended.
+    """
+
+    dtype = image.dtype.newbyteorder("=")
+    if dtype not in BITPIX:
+        raise ValueError("Cannot write an image of type %s" % image.dtype)
+
+    hdr = fits.Header()
+    hdr['XTENSION'] = ('IMAGE', 'Image extension')
+    hdr['BITPIX'] = (BITPIX[dtype], 'array data type')
+    hdr['NAXIS'] = (image.ndim, 'number of array dimensions')
+    for axis, size in enumerate(reversed(image.shape)):
+        hdr['NAXIS%d' % (axis + 1)] = size
+    hdr['PCOUNT'] = (0, 'number of parameters')
+    hdr['GCOUNT'] = (1, 'number of groups')
+
+    # Keep the scaling cards of images stored as integers
+    if header is not None:
+        hdr.extend(header, strip=False, unique=True)
+    return hdr
+
+
+def padded_size(size):
+    """
+    The size of data padded to a whole FITS block
+    """
+    return -(-size // 2880) * 2880
+
+
+def quantize_weights(image):
+    """
+    Quantize a weight image to unsigned 16 bit integers scaled so the
+    largest weight is the largest integer, returning the integers stored
+    as signed and the header cards which restore the weights. Readers of
+    the file see the weights to within half the scale factor.
+    """
+
+    top = float(np.max(image)) if image.size else 0.0
+    scale = top / 65535.0 if top > 0.0 else 1.0
+
+    stored = np.rint(image / np.float32(scale))
+    np.clip(stored, 0.0, 65535.0, out=stored)
+    stored -= 32768.0
+    stored = stored.astype(np.int16)
+
+    cards = fits.Header()
+    cards['BSCALE'] = scale
+    cards['BZERO'] = 32768.0 * scale
+    return stored, cards
+
+
+def dictionary_context(context):
+    """
+    Encode a context image as a table of the distinct bit patterns it
+    holds and an image of indices into the table. Returns None if there
+    are too many patterns to index with unsigned 16 bit integers.
+    Otherwise returns the indices stored as signed, the cards which make
+    them unsigned and the table, one pattern per row.
+    """
+
+    planes = context.reshape(context.shape[0], -1)
+    if planes.shape[0] == 1:
+        table, index = np.unique(planes[0], return_inverse=True)
+        table = table.reshape(-1, 1)
+
+    else:
+        # Compare the planes of each pixel as a single value
+        pixels = np.ascontiguousarray(planes.T)
+        rows = pixels.view(np.dtype((np.void, pixels.dtype.itemsize *
+                                     pixels.shape[1]))).ravel()
+        rows, first, index = np.unique(rows, return_index=True,
+                                       return_inverse=True)
+        table = pixels[first]
+
+    if len(table) > 65536:
+        return None
+
+    stored = (index.reshape(context.shape[1:]) - 32768).astype(np.int16)
+
+    cards = fits.Header()
+    cards['BSCALE'] = 1
+    cards['BZERO'] = 32768
+    return stored, cards, table.astype(np.int32)
+
+
+def decode_weights(data, form):
+    """
+    Return weights read from an extension as float32
+    """
+
+    if form == "float16":
+        return data.view(data.dtype.str[0] + "f2").astype(np.float32)
+    return data.astype(np.float32)
+
+
+def decode_context(index, table):
+    """
+    Return the context image of an image of indices into a table of
+    patterns
+    """
+
+    return np.ascontiguousarray(table.astype(np.int32).T[:, index])
+
+
+class WeightBands(object):
+    """
+    The weight image of an extension stored in a compact format, read
+    and decoded only for the rows it is indexed by. Bands may be read
+    from several threads.
+    """
+    def __init__(self, hdu, form):
+        self.section = hdu.section
+        self.shape = hdu.shape
+        self.form = form
+        self.lock = threading.Lock()
+
+    def __getitem__(self, rows):
+        with self.lock:
+            data = self.section[rows]
+        return decode_weights(data, self.form)
+
+
+class ContextBands(object):
+    """
+    A dictionary coded context image, read and decoded only for the
+    rows it is indexed by. It is indexed by planes, then rows.
+    """
+    def __init__(self, hdu, table):
+        self.section = hdu.section
+        self.table = np.asarray(table, dtype=np.int32)
+        self.shape = (self.table.shape[1],) + tuple(hdu.shape)
+        self.lock = threading.Lock()
+
+    def __getitem__(self, key):
+        planes, rows = key
+        with self.lock:
+            index = self.section[rows]
+        return decode_context(index, self.table)[planes]
+
+
+def image_chunks(image, offset, chunk_size=CHUNK_SIZE):
+    """
+    Split a 2d or 3d image into chunks of rows, returning each chunk and
+    its offset in the file when the image data starts at offset. The
+    chunks are views, so no layout of the image is copied.
+    """
+
+    planes = image[np.newaxis] if image.ndim == 2 else image
+    ny, nx = planes.shape[-2:]
+    rowsize = nx * image.dtype.itemsize
+    nrows = max(1, chunk_size // max(1, rowsize))
+
+    chunks = []
+    for plane in planes:
+        for start in range(0, ny, nrows):
+            chunks.append((plane[start:start + nrows], offset))
+            offset += min(nrows, ny - start) * rowsize
+    return chunks
+
+
+def pwrite(fd, data, offset):
+    """
+    Write all of data to a file descriptor at an offset
+    """
+
+    data = memoryview(data).cast("B")
+    if hasattr(os, "pwrite"):
+        while len(data):
+            count = os.pwrite(fd, data, offset)
+            data = data[count:]
+            offset += count
+
+    else:
+        with _seek_lock:
+            os.lseek(fd, offset, os.SEEK_SET)
+            while len(data):
+                data = data[os.write(fd, data):]
+
+
+def write_chunk(fd, chunk, offset, scale, divisor, buffers):
+    """
+    Convert a chunk of rows to big endian, dividing it by the rows of a
+    weight image and multiplying it by scale if they are set, and write
+    it at its offset. The divisor is the weight rows and the value of
+    pixels with zero weight. The conversion buffer of each thread is kept
+    in buffers and reused.
+    """
+
+    dtype = chunk.dtype.newbyteorder(">")
+    buffer = getattr(buffers, "buffer", None)
+    nbytes = chunk.size * dtype.itemsize
+    if buffer is None or buffer.nbytes < nbytes:
+        buffer = np.empty(nbytes, dtype=np.uint8)
+        buffers.buffer = buffer
+
+    out = buffer[:nbytes].view(dtype).reshape(chunk.shape)
+    if divisor is not None:
+        weights, fill_value = divisor
+        np.divide(chunk, weights, out=out, where=(weights != 0.0))
+        np.copyto(out, fill_value, where=(weights == 0.0))
+        if scale is not None:
+            np.multiply(out, scale, out=out, casting="unsafe")
+    elif scale is None:
+        np.copyto(out, chunk)
+    else:
+        np.multiply(chunk, scale, out=out, casting="unsafe")
+    pwrite(fd, out, offset)
+
+
+def divide_image(image, divisor):
+    """
+    Return an image divided by a weight image, with pixels of zero weight
+    set to a fill value, as write_chunk divides a chunk
+    """
+
+    weights, fill_value = divisor
+    result = np.empty_like(image)
+    np.divide(image, weights, out=result, where=(weights != 0.0))
+    np.copyto(result, fill_value, where=(weights == 0.0))
+    return result
+
+
+def split_extension(extension):
+    """
+    Return the header, image, scale and divisor of an extension, whose
+    divisor is optional
+    """
+
+    header, image, scale = extension[:3]
+    divisor = extension[3] if len(extension) > 3 else None
+    return header, image, scale, divisor
+
+
+def write_product(outfile, phdr, extensions, chunk_size=CHUNK_SIZE,
+                  nthreads=None, compress=None):
+    """
+    Write a FITS file with a primary header and image extensions.
+
+    The headers are written first and the file is extended over the
+    data of every extension. The data is then written in chunks by a
+    pool of threads, each converting its chunk in its own buffer. The
+    file is written under a temporary name and renamed over outfile when
+    complete, so a product being read, or memory mapped, is never seen
+    half written.
+
+    Parameters
+    ----------
+
+    outfile : str
+        The name of the file.
+
+    phdr : header
+        The cards of the primary header, which has no data.
+
+    extensions : list of tuples
+        The header cards, image and scale factor of each extension, and
+        optionally a divisor. The scale factor may be None. A divisor is
+        a weight image of the same shape and the value of pixels with zero
+        weight, and the image is written divided by the weights, a chunk
+        at a time, before it is scaled.
+
+    chunk_size : int, optional
+        The bytes of each image converted at a time.
+
+    nthreads : int, optional
+        The number of threads writing chunks, or compressing extensions.
+        The default is the number of processors.
+
+    compress : str, optional
+        If set, the extensions are tile compressed by astropy with this
+        compression type, such as "RICE_1" or "GZIP_2", each extension in
+        its own thread. Floating point images are written losslessly by
+        the gzip types and quantized by the others.
+    """
+
+    if nthreads is None:
+        nthreads = os.cpu_count() or 1
+
+    # The mandatory cards of a primary header without data come first
+    primary = fits.PrimaryHDU().header
+    primary.extend(phdr, unique=True, update=True)
+    primary['NAXIS'] = 0
+
+    tmpfile = outfile + ".tmp"
+    try:
+        if compress:
+            write_compressed(tmpfile, primary, extensions, compress, nthreads)
+        else:
+            write_layout(tmpfile, primary, extensions, chunk_size, nthreads)
+        os.replace(tmpfile, outfile)
+
+    finally:
+        if os.path.exists(tmpfile):
+            os.remove(tmpfile)
+
+
+def write_layout(outfile, primary, extensions, chunk_size, nthreads):
+    """
+    Write the headers and lay out the data of the extensions, then fill
+    in the data in parallel.
+    """
+
+    chunks = []
+    with open(outfile, "wb") as handle:
+        handle.write(primary.tostring().encode("ascii"))
+
+        for extension in extensions:
+            header, image, scale, divisor = split_extension(extension)
+            header = image_header(image, header)
+            handle.write(header.tostring().encode("ascii"))
+
+            offset = handle.tell()
+            image_parts = image_chunks(image, offset, chunk_size)
+            if divisor is None:
+                chunks.extend((chunk, chunk_offset, scale, None)
+                              for chunk, chunk_offset in image_parts)
+            else:
+                # The weights are split into the same rows as the image
+                weights, fill_value = divisor
+                if weights.shape != image.shape or weights.dtype != image.dtype:
+                    raise ValueError("Weights do not match the image they divide")
+                weight_parts = image_chunks(weights, offset, chunk_size)
+                chunks.extend((chunk, chunk_offset, scale, (weight, fill_value))
+                              for (chunk, chunk_offset), (weight, unused)
+                              in zip(image_parts, weight_parts))
+
+            # Extend the file over the data, the padding is left zero
+            size = padded_size(image.size * image.dtype.itemsize)
+            handle.truncate(offset + size)
+            handle.seek(offset + size)
+
+    buffers = threading.local()
+    fd = os.open(outfile, os.O_WRONLY | getattr(os, "O_BINARY", 0))
+    try:
+        with concurrent.futures.ThreadPoolExecutor(nthreads) as executor:
+            list(executor.map(lambda args: write_chunk(fd, *args, buffers=buffers),
+                              chunks))
+    finally:
+        os.close(fd)
+
+
+def write_compressed(outfile, primary, extensions, compress, nthreads):
+    """
+    Compress each extension in its own thread and append them after the
+    primary header.
+    """
+
+    directory = os.path.dirname(os.path.abspath(outfile))
+
+    def compress_one(extension):
+        header, image, scale, divisor = split_extension(extension)
+        if divisor is not None:
+            image = divide_image(image, divisor)
+        if scale is not None:
+            image = image * scale
+
+        # Gzip compresses floating point images losslessly
+        options = {}
+        if compress.upper().startswith("GZIP"):
+            options['quantize_level'] = 0.0
+
+        # Astropy drops the scaling cards of the header it is given
+        header = header.copy()
+        scaling = [(key, header.pop(key)) for key in ('BSCALE', 'BZERO')
+                   if key in header]
+
+        handle = tempfile.TemporaryFile(dir=directory)
+        hdu = fits.CompImageHDU(data=image, header=header,
+                                compression_type=compress, **options)
+        for key, value in scaling:
+            hdu.header[key] = value
+        fits.HDUList([fits.PrimaryHDU(), hdu]).writeto(handle)
+        return handle
+
+    with concurrent.futures.ThreadPoolExecutor(nthreads) as executor:
+        parts = list(executor.map(compress_one, extensions))
+
+    # Each part starts with the single block of an empty primary header
+    skip = padded_size(len(fits.PrimaryHDU().header.tostring()))
+    try:
+        with open(outfile, "wb") as handle:
+            handle.write(primary.tostring().encode("ascii"))
+            for part in parts:
+                part.seek(skip)
+                shutil.copyfileobj(part, handle)
+    finally:
+        for part in parts:
+            part.close()